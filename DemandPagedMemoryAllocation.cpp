@@ -8,72 +8,1098 @@
 #include <thread>
 #include <functional>
 #include <queue>
+#include <deque>
+#include <set>
+#include <tuple>
 #include <stdexcept>   
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+#include <list>
+#include <atomic>
+#include <random>
+#include <iomanip>
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include "PageMath.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(__AVX2__) || defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
-// Global variables
-int PAGE_SIZE = 200;     // Page size and page frame size
-int TOTAL_MEMORY = 2000; // Total memory available 
+// The settings and shared devices of a simulation live in a SimulatorContext, defined once
+// the devices are. A thread simulates in the context SIM points at: the main context unless
+// it was given another. Job threads take their simulation's, and every --sweep point gets a
+// context of its own, so simulations running side by side share nothing.
+struct SimulatorContext;
+extern thread_local SimulatorContext* SIM;
 
-// For thread safety
-mutex mtx; 
+// Splitting addresses into page number and offset. Page sizes worth simulating are powers of
+// two, where that is a shift and a mask: FixedPageGeometry makes them compile-time constants
+// for the sizes replay is specialized on, PageGeometry takes any size and divides only if the
+// size is not a power of two.
+template <int SHIFT>
+struct FixedPageGeometry {
+    static constexpr uint64_t SIZE = 1ULL << SHIFT;
+    constexpr uint64_t pageOf(uint64_t addr) const { return addr >> SHIFT; }
+    constexpr uint64_t offsetOf(uint64_t addr) const { return addr & (SIZE - 1); }
+};
+using Page4K = FixedPageGeometry<12>;
+using Page64K = FixedPageGeometry<16>;
+using Page2M = FixedPageGeometry<21>;
+
+struct PageGeometry {
+    uint64_t size;
+    int shift = -1;   // log2(size) for a power of two, else -1
+    uint64_t mask = 0;
 
-// Struct for each page of a job
-struct Page {
-    int size_of_content;
-    int page_no;
-    int job_number;
+    explicit PageGeometry(uint64_t page_size) : size(page_size) {
+        if (page_size == 0 || (page_size & (page_size - 1)) != 0) return;
+        shift = 0;
+        while ((1ULL << shift) != page_size) shift++;
+        mask = page_size - 1;
+    }
+    uint64_t pageOf(uint64_t addr) const { return shift >= 0 ? addr >> shift : addr / size; }
+    uint64_t offsetOf(uint64_t addr) const { return shift >= 0 ? addr & mask : addr % size; }
 };
 
-// Struct for each Job
+// Struct for each Job. Its pages are numbered from JobTableEntry::first_page_no and are
+// page_size bytes each except the last, so nothing is stored per page.
 struct Job {
     int number;
-    int size;
-    vector<Page> pages;
+    uint64_t size;
+    int num_pages = 0;
+};
+
+// Struct for Page Map Table entry for virtual, packed into one 64-bit word so that page tables
+// of tens of millions of pages stay small: bits 0-31 hold the frame number plus one (0 when
+// the page has no frame) and the bits above them the present, referenced, modified and
+// loading flags, and prefetched for a page read ahead that nobody has referenced yet. Filled
+// and accessed serve huge pages (see HugePageState). The page number is implied by the entry's
+// place in its page table.
+// The word is atomic, so hits read the mapping and set bits without a lock and a fault
+// publishes frame and present bit in one store. The mapping only changes inside a fault, under
+// ReplacementState::lock; loading marks a fault in progress so a second fault on the same page
+// waits for it.
+struct PageMapTableEntry {
+    static constexpr uint64_t FRAME_MASK = 0xFFFFFFFFULL;
+    static constexpr uint64_t PRESENT = 1ULL << 32;
+    static constexpr uint64_t REFERENCED = 1ULL << 33;
+    static constexpr uint64_t MODIFIED = 1ULL << 34;
+    static constexpr uint64_t LOADING = 1ULL << 35;
+    static constexpr uint64_t PREFETCHED = 1ULL << 36;
+    static constexpr uint64_t FILLED = 1ULL << 37;     // loaded by a huge-page promotion, not referenced yet
+    static constexpr uint64_t ACCESSED = 1ULL << 38;   // referenced since the last huge-page density scan
+
+    atomic<uint64_t> word{0};
+
+    static int frameOf(uint64_t bits) { return (int)(bits & FRAME_MASK) - 1; }
+    int frameNo() const { return frameOf(word.load()); }
+    bool present() const { return (word.load() & PRESENT) != 0; }
+    bool referenced() const { return (word.load() & REFERENCED) != 0; }
+    bool modified() const { return (word.load() & MODIFIED) != 0; }
+    bool loading() const { return (word.load() & LOADING) != 0; }
+    // Both return the bits as they were before
+    uint64_t set(uint64_t bits) { return word.fetch_or(bits); }
+    uint64_t clear(uint64_t bits) { return word.fetch_and(~bits); }
+    // Map the page into a frame; only the fault holding the loading bit does this
+    void map(int frame_no, bool is_write) {
+        word = (uint64_t)(frame_no + 1) | PRESENT | REFERENCED | (is_write ? MODIFIED : 0) | LOADING;
+    }
+    // Map a page read ahead: not referenced yet, so the policy sees it as cold
+    void mapPrefetched(int frame_no) { word = (uint64_t)(frame_no + 1) | PRESENT | PREFETCHED; }
+    void mapFilled(int frame_no) { word = (uint64_t)(frame_no + 1) | PRESENT | FILLED; }
+};
+
+// Physical memory as parallel per-frame arrays indexed by frame number, so replacement scans
+// and bookkeeping walk contiguous memory. Whether a frame is occupied is kept only in the
+// Memory Map Table. job_no, page_no, owner and the queue links change only under
+// ReplacementState::lock. busy is the frame lock, held from the moment a fault claims the
+// frame until the new page is registered.
+struct FrameTable {
+    vector<atomic<bool>> busy;
+    vector<int> job_no;
+    vector<int> page_no;
+    vector<PageMapTableEntry*> owner;    // reverse map: PMT entry of the page held in the frame
+    vector<atomic<uint64_t>> last_used;  // access_clock of the latest reference
+    vector<int> prev, next;              // links in the replacement queue
+    vector<uint8_t> queue_id;            // which replacement list the frame is on (ARC T1/T2, 2Q A1in/Am)
+
+    int size() const { return (int)page_no.size(); }
+};
+
+// Page replacement algorithms.
+// CLOCK sweeps a circular hand over pageFrames, SECOND_CHANCE recycles the FIFO queue, and
+// ENHANCED_CLOCK ranks frames by their (referenced, modified) class so clean pages go first.
+// ARC, TWO_Q and LIRS are scan resistant: they remember recently evicted pages in ghost
+// lists so a single sequential sweep cannot flush pages that are reused.
+// OPT needs the future and is only available when replaying a trace.
+enum class ReplacementAlgorithm { FIFO, LRU, CLOCK, SECOND_CHANCE, ENHANCED_CLOCK, ARC, TWO_Q, LIRS, OPT };
+
+// Intrusive doubly linked list of frames, threaded through FrameTable::prev/next
+struct FrameList {
+    int head = -1, tail = -1;
+    int size = 0;
+};
+
+// Recency-ordered set of page numbers that are no longer resident (oldest at the front)
+struct GhostList {
+    list<int> order;
+    unordered_map<int, list<int>::iterator> where;
+
+    bool contains(int page_no) const { return where.count(page_no) > 0; }
+    int size() const { return (int)where.size(); }
+    void pushBack(int page_no) { where[page_no] = order.insert(order.end(), page_no); }
+    void remove(int page_no) {
+        auto it = where.find(page_no);
+        if (it == where.end()) return;
+        order.erase(it->second);
+        where.erase(it);
+    }
+    void popFront() { remove(order.front()); }
+};
+
+// Adaptive Replacement Cache (Megiddo & Modha). T1 holds pages seen once recently, T2 pages
+// seen at least twice; B1/B2 remember pages evicted from each. Ghost hits move the target
+// size p of T1 towards whichever list would have kept the page.
+struct ArcState {
+    FrameList t1, t2;
+    GhostList b1, b2;
+    int capacity = 0;
+    int p = 0;
+    uint64_t t1_hits = 0, t2_hits = 0, b1_hits = 0, b2_hits = 0;
+};
+
+// Full 2Q (Johnson & Shasha). New pages enter the A1in FIFO; pages evicted from it are
+// remembered in A1out, and only a re-reference while in A1out promotes a page to the Am LRU.
+struct TwoQState {
+    FrameList a1in, am;
+    GhostList a1out;
+    int kin = 1, kout = 1;         // A1in and A1out capacities
+    uint64_t a1in_hits = 0, am_hits = 0, a1out_hits = 0;
+};
+
+// Low Inter-reference Recency Set (Jiang & Zhang). Pages with a short reuse distance are LIR
+// and stay resident; the rest are HIR and queue in Q for eviction. The recency stack S keeps
+// recently evicted HIR pages so their next reference can prove a short reuse distance.
+struct LirsEntry {
+    bool lir = false, resident = false;
+    bool in_stack = false, in_queue = false;
+    list<int>::iterator stack_pos, queue_pos;
+    int frame_no = -1;
+};
+
+struct LirsState {
+    list<int> stack;               // S, most recent at the back
+    list<int> queue;               // Q of resident HIR pages, next victim at the front
+    unordered_map<int, LirsEntry> pages;
+    GhostList non_resident;        // non-resident HIR pages still in S, to bound its size
+    int lir_capacity = 1, lir_count = 0;
+    uint64_t lir_hits = 0, hir_hits = 0, ghost_hits = 0;
+};
+
+// Belady's OPT/MIN: evict the page whose next use lies furthest in the future. Only trace
+// replay knows the future, so it sets current_next_use before every reference. The heap is
+// keyed by next use with lazy deletion: an entry is live while it matches frame_next_use.
+struct OptState {
+    vector<uint64_t> frame_next_use;
+    priority_queue<pair<uint64_t, int>> heap;
+    uint64_t current_next_use = 0;
+};
+
+// How frames are divided among jobs. GLOBAL lets the replacement algorithm evict any job's
+// page. The local modes give every job a resident set of its own, replace within it by second
+// chance, and size it from the job's own virtual time (its count of references):
+// WORKING_SET keeps the pages referenced in the last ws_window references and releases the
+// rest; PFF (page fault frequency) grows the set on a fault that comes within pff_interval
+// references of the previous one and otherwise releases every page not referenced since.
+enum class FrameAllocation { GLOBAL, WORKING_SET, PFF };
+
+// Resident set of one job under local allocation. Its frames are linked through
+// FrameTable::prev/next, which the global policies leave unused in this mode.
+struct JobResidentSet {
+    FrameList frames;                   // second chance order, next victim at the head
+    atomic<uint64_t> virtual_time{0};   // references made by the job
+    uint64_t last_fault = 0;            // PFF: virtual time of the previous fault
+    uint64_t last_trim = 0;             // WORKING_SET: virtual time of the previous trim
+    atomic<bool> suspended{false};
+    int demand = 0;                     // resident set size when the job was suspended
 };
 
-// Struct for each page frame in physical memory
-struct PageFrame {
-    int size_of_content;
-    int page_frame_no;
-    bool is_occupied = false;
-    int job_no = -1;
+// Load control: when memory is full and a job has to grow, the system is overcommitted and
+// the lowest-priority job (the last of priority_order) that ranks below the faulting one is
+// suspended and its frames released. A suspended job's next reference waits until
+// its old resident set fits into free memory again, or until every worker is waiting.
+struct LocalAllocationState {
+    FrameAllocation mode = FrameAllocation::GLOBAL;
+    vector<JobResidentSet> jobs;
+    condition_variable resumed;          // waited on with ReplacementState::lock
+    bool load_control = false;
+    vector<int> priority_order;          // jobs from highest to lowest priority
+    vector<int> rank;                    // each job's place in priority_order
+    int running_threads = 0, waiting_threads = 0;
+    uint64_t released = 0, suspensions = 0, resumptions = 0;
+};
+
+// Per-job stream detector for read-ahead. A fault at the same stride from the previous fault
+// as that one was from its predecessor confirms a stream (sequential access is stride 1) and
+// reads the next window of pages ahead. Touching the first page of a read-ahead reads the
+// window after it, so a stream that keeps up never faults again. Every read-ahead doubles the
+// window, up to prefetch_window pages.
+struct StreamDetector {
+    int last_page = -1;      // job page index of the last fault or trigger hit
+    int stride = 0;
+    int window = 0;          // pages in the last read-ahead, 0 while no stream is confirmed
+    int trigger = -1;        // first page of the last read-ahead
+    int next = -1;           // first page after it
+};
+
+struct PrefetchState {
+    vector<StreamDetector> jobs;
+    unordered_set<int> displaced;   // page_no of pages evicted to make room for a prefetch
+};
+
+// Huge pages (--huge-page-size), by reservation: a job's pages are grouped into aligned regions
+// of huge_page_pages pages. The first fault on a region with nothing resident reserves an
+// aligned run of free frames for it if there is one, and every page of the region then loads
+// into its own slot of the run. Every HUGE_SCAN_INTERVAL references the reserved regions are
+// scanned for access density, the share of their pages referenced since the last scan. A dense
+// region is promoted: its missing pages are filled in and one TLB entry maps the whole run.
+// A huge page that turns sparse, or loses a page to the policy, is demoted to base pages.
+// Runs are reserved from the top of memory and base frames claimed from the bottom, so base
+// pages break as few runs as possible. When memory is full the reservation with the fewest
+// resident pages is broken and its idle frames freed. Idle reserved frames are marked occupied
+// in the Memory Map Table but have no owner. Everything but the counters changes under
+// ReplacementState::lock.
+const uint64_t HUGE_SCAN_INTERVAL = 8192;
+
+struct HugeRegion {
+    atomic<int> run{-1};           // first frame of the region's reservation, -1 if none
+    atomic<bool> huge{false};      // promoted: one TLB entry maps the run
+    atomic<int> touched{0};        // pages referenced since the last scan, while reserved
+    int resident = 0;              // pages in memory or loading, in the run or not
+};
+
+struct HugePageState {
+    bool active = false;
+    int pages = 0, shift = 0;               // huge_page_pages and its log2
+    vector<vector<HugeRegion>> jobs;        // per job, per region
+    vector<pair<int, int>> reservations;    // (job, region) of every reservation
+    vector<int> reservation_of;             // per run of frames: index into reservations, or -1
+    int idle_frames = 0;                    // reserved frames holding no page
+    uint64_t reserved = 0, broken = 0, promotions = 0, demotions = 0;
+    atomic<uint64_t> fills{0}, fill_hits{0}, fill_wasted{0}, tlb_hits{0};
+};
+
+// Replacement bookkeeping shared by all jobs. Occupied frames sit in queue with the
+// next victim at the head: FIFO and SECOND_CHANCE keep load order, LRU moves a frame to
+// the tail on every hit. The CLOCK variants ignore the queue and use hand instead.
+// lock guards everything here except hits; it is held only for the O(1) bookkeeping of a
+// fault, and on hits only by policies that reorder their lists (see tracksHits).
+struct ReplacementState {
+    ReplacementAlgorithm algorithm = ReplacementAlgorithm::LRU;
+    FrameList queue;
+    int hand = 0;
+    ArcState arc;
+    TwoQState twoQ;
+    LirsState lirs;
+    OptState opt;
+    LocalAllocationState local;
+    PrefetchState prefetch;
+    HugePageState huge;
+    mutex lock;
+    atomic<uint64_t> hits{0};
+    uint64_t misses = 0;
+};
+
+// What the policy learned about one faulting page, carried from onPageFault to the victim
+// choice and to onFrameLoaded so that concurrent faults don't share it
+struct PageFault {
     int page_no = -1;
-    time_t time_loaded = 0; 
-    time_t last_used = 0;    
+    bool in_ghost_b2 = false;         // ARC: the page was remembered in B2
+    bool evict_without_ghost = false; // ARC: L1 is full of resident pages
+    bool load_into_frequent = false;  // ARC: load into T2; 2Q: load into Am
 };
 
-// Struct for Page Map Table entry for virtual
-struct PageMapTableEntry {
-    int page_no, page_frame_no = -1;
-    bool modified = false, referenced = false, status = false;
-    time_t time_loaded = 0;
-    time_t last_used = 0;
+// Memory Map Table: the single record of which frames are occupied, one bit per frame.
+// A summary bitmap above it has a bit per 64-frame word that may still hold a free frame, so
+// claiming a frame is two count-trailing-zeros steps, and a free counter makes a full memory
+// an O(1) answer. All updates are atomic, so faults claim and release frames without a lock.
+struct MemoryMapTable {
+    vector<atomic<uint64_t>> occupied;   // bit i of word w: frame w * 64 + i is occupied
+    vector<atomic<uint64_t>> has_free;   // bit j of word s: occupied[s * 64 + j] has a clear bit
+    atomic<int> free_frames{0};
+    int num_frames = 0;
+
+    void init(int frames);
+    int claimFreeFrame();
+    int claimRun(int frames);
+    void release(int frame_no);
+    bool isOccupied(int frame_no) const {
+        return (occupied[frame_no / 64].load(memory_order_relaxed) >> (frame_no % 64)) & 1;
+    }
+};
+
+// Page table of one job, indexed by the job's virtual page number (page_no - first_page_no).
+// With one level it is the flat PMT, built in full up front. With 2 to 4 levels it is a radix
+// tree: each level resolves an equal share of the page number bits and only the top table
+// exists up front. Lower tables are allocated on first touch and installed with a
+// compare-and-swap, so a sparse address space pays only for the tables it touches.
+class PageTable {
+public:
+    PageTable() = default;
+    PageTable(const PageTable&) = delete;
+    PageTable& operator=(const PageTable&) = delete;
+    ~PageTable() { freeTable(root, 0); }
+
+    void init(int first_page_no, int num_pages, int levels);
+    PageMapTableEntry& entry(int vpn);          // page walk, allocating missing tables
+    PageMapTableEntry* find(int vpn) const;     // page walk that allocates nothing; nullptr if untouched
+    void forEachEntry(const function<void(int, PageMapTableEntry&)>& visit);
+
+    int levels() const { return num_levels; }
+    int numPages() const { return num_pages; }
+    // The entries of a flat (one level) table as one array indexed by vpn, else nullptr
+    PageMapTableEntry* flatEntries() const { return num_levels == 1 ? (PageMapTableEntry*)root : nullptr; }
+    int tables() const { return num_tables; }
+    size_t bytes() const { return table_bytes; }
+    uint64_t walks() const { return num_walks; }
+
+private:
+    void* allocateTable(int level);
+    void freeTable(void* table, int level);
+    void forEachIn(void* table, int level, int base, const function<void(int, PageMapTableEntry&)>& visit);
+    int fanout(int level) const { return level == 0 ? root_fanout : 1 << bits_per_level; }
+    int indexAt(int vpn, int level) const {
+        int shift = (num_levels - 1 - level) * bits_per_level;
+        return level == 0 ? vpn >> shift : (vpn >> shift) & ((1 << bits_per_level) - 1);
+    }
+
+    int first_page_no = 0, num_pages = 0;
+    int num_levels = 1, bits_per_level = 0, root_fanout = 0;
+    void* root = nullptr;        // leaf array of PMT entries, or array of atomic<void*> children
+    atomic<int> num_tables{0};
+    atomic<size_t> table_bytes{0};
+    atomic<uint64_t> num_walks{0};
+};
+
+// Software TLB in front of the PMT. Its entries are split into sets of ways entries each (a
+// single set is fully associative). Entries are tagged with the job number as address space
+// ID plus the job's virtual page number, so jobs share the TLB without flushes. Each set has
+// its own spinlock; an eviction drops the victim's entry before the frame is reused.
+enum class TlbReplacement { LRU, FIFO, RANDOM };
+
+struct TlbEntry {
+    int asid = -1;        // -1 marks an invalid entry
+    int vpn = -1;
+    int frame_no = -1;
+    PageMapTableEntry* pte = nullptr; // the cached PMT entry, so a hit sets its bits without a walk
+    uint64_t stamp = 0;   // per-set tick of the last use (LRU) or of the fill (FIFO, RANDOM)
+};
+
+class Tlb {
+public:
+    Tlb() { configure(64, 4, TlbReplacement::LRU); }
+
+    // entries == 0 disables the TLB, ways == 0 makes it fully associative
+    bool configure(int entries, int ways, TlbReplacement policy);
+    bool configureLike(const Tlb& other) { return configure((int)other.entries.size(), other.ways, other.policy); }
+    void flush();
+    bool enabled() const { return num_sets > 0; }
+    bool lookup(int asid, int vpn, int& frame_no, PageMapTableEntry*& pte);
+    void insert(int asid, int vpn, PageMapTableEntry& row);
+    void invalidate(int asid, int vpn);
+    void printStats() const;
+    const vector<TlbEntry>& contents() const { return entries; }
+
+    atomic<uint64_t> hits{0}, misses{0};
+
+private:
+    int setOf(int vpn) const { return (int)((unsigned)vpn % (unsigned)num_sets); }
+    void lockSet(int set) { while (locks[set].exchange(true, memory_order_acquire)) this_thread::yield(); }
+    void unlockSet(int set) { locks[set].store(false, memory_order_release); }
+
+    int num_sets = 0, ways = 0;
+    TlbReplacement policy = TlbReplacement::LRU;
+    vector<TlbEntry> entries;          // set s owns entries[s * ways, (s + 1) * ways)
+    vector<atomic<bool>> locks;
+    vector<uint64_t> ticks;            // per-set logical clock for stamps
 };
 
-// Struct for Memory Map Table entry
-struct MemoryMapTableEntry {
-    int page_frame_no;
-    bool is_occupied;
+// Event log. Job threads never print: they append fixed-size events to a ring buffer of their
+// own, and a background writer drains all rings and formats them as text, NDJSON or binary
+// records. The level picks which events are produced at all, so SILENT costs one compare per
+// reference. At SNAPSHOTS the writer also keeps a shadow copy of the frames and, after each
+// pass over the rings, reports only the frames that changed in it.
+enum class LogLevel { SILENT, FAULTS, ALL, SNAPSHOTS };
+enum class LogFormat { TEXT, NDJSON, BINARY };
+
+// FAULTS: JOB, FAULT, EVICT, LOAD, SUSPEND, RESUME, PREFETCH. ALL adds HIT and RESOLVE. FRAME
+// is a binary snapshot delta.
+enum class LogEventType : uint8_t { JOB, HIT, FAULT, EVICT, LOAD, RESOLVE, FRAME, SUSPEND, RESUME, PREFETCH };
+
+// Binary log layout: EventFileHeader, then LogEvent records in the order they were drained.
+// Events of one thread keep their order; time orders them across threads.
+const char EVENT_MAGIC[4] = {'D', 'P', 'E', 'V'};
+const uint32_t EVENT_VERSION = 1;
+
+struct EventFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t record_size;
+};
+
+struct LogEvent {
+    uint64_t time;      // access_clock of the reference
+    uint64_t value;     // RESOLVE: logical address; JOB: number of pages
+    int32_t job_no;     // -1 in a FRAME record for an empty frame
+    int32_t page_no;
+    int32_t frame_no;
+    LogEventType type;
+    uint8_t reserved[3];
+};
+
+// Single-producer single-consumer ring: only its thread advances tail, only the writer head
+struct EventRing {
+    static const uint32_t CAPACITY = 4096; // power of two
+    LogEvent events[CAPACITY];
+    alignas(64) atomic<uint64_t> head{0};
+    alignas(64) atomic<uint64_t> tail{0};
+};
+
+class EventLog {
+public:
+    ~EventLog();
+
+    // Open the output once (an empty path is stdout); events flow between start and stop
+    bool configure(LogLevel level, LogFormat format, const string& path);
+    void start();
+    void stop();
+    bool logs(LogLevel level) const { return active >= level; }
+    void emit(LogEventType type, uint64_t time, int job_no, int page_no, int frame_no, uint64_t value = 0);
+
+private:
+    EventRing& threadRing();
+    void writerLoop();
+    bool drain();
+    void write(const LogEvent& event);
+    void writeSnapshot(uint64_t time);
+    void markFrame(int frame_no, int job_no, int page_no);
+
+    LogLevel level = LogLevel::SNAPSHOTS, active = LogLevel::SILENT;
+    LogFormat format = LogFormat::TEXT;
+    FILE* out = stdout;
+    int page_size = 0;
+    mutex rings_lock;                   // guards rings against threads registering a new one
+    vector<unique_ptr<EventRing>> rings;
+    thread writer;
+    atomic<bool> running{false};
+    vector<pair<int, int>> shadow;      // writer's view of every frame: (job, page), job -1 if empty
+    vector<int> changed;                // frames changed since the last snapshot
+    vector<bool> is_changed;
+};
+
+// Paging counters of one job. Atomic because the stress test's foreign references update
+// other threads' jobs; aligned so jobs of different threads don't share a cache line.
+// Copying takes a snapshot.
+struct alignas(64) PagingCounters {
+    atomic<uint64_t> hits{0}, faults{0};
+    atomic<uint64_t> evictions{0}, dirty_evictions{0}; // of this job's pages
+    atomic<int64_t> resident{0};                       // pages in memory right now
+    atomic<uint64_t> prefetches{0};                    // pages read ahead
+    atomic<uint64_t> prefetch_hits{0};                 // ... and referenced before eviction
+    atomic<uint64_t> prefetch_wasted{0};               // ... and evicted unreferenced
+    atomic<uint64_t> pollution_faults{0};              // faults on pages a prefetch had evicted
+    atomic<uint64_t> clock_ns{0};                      // simulated time: reference_ns a reference, plus stalls
+    atomic<uint64_t> stall_ns{0};                      // ... of which waiting for the swap device
+
+    PagingCounters() = default;
+    PagingCounters(const PagingCounters& other) { *this = other; }
+    PagingCounters& operator=(const PagingCounters& other) {
+        hits = other.hits.load();
+        faults = other.faults.load();
+        evictions = other.evictions.load();
+        dirty_evictions = other.dirty_evictions.load();
+        resident = other.resident.load();
+        prefetches = other.prefetches.load();
+        prefetch_hits = other.prefetch_hits.load();
+        prefetch_wasted = other.prefetch_wasted.load();
+        pollution_faults = other.pollution_faults.load();
+        clock_ns = other.clock_ns.load();
+        stall_ns = other.stall_ns.load();
+        return *this;
+    }
 };
 
 // Struct for Job Table entry 
+// Pages are numbered sequentially, so a job's pages are first_page_no .. first_page_no + pages - 1
+// and its page table is indexed by page_no - first_page_no.
 struct JobTableEntry {
     int job_no, PMT_ID;
+    int first_page_no;
+    PagingCounters counters;
+};
+
+// Log-linear histogram in the style of HdrHistogram: values below 2^SUB_BITS get a bucket
+// each, and every power of two above that is split into 2^SUB_BITS buckets, so any recorded
+// value is known to within 1/2^SUB_BITS. Counts are atomic so an exporter can read while the
+// owning thread records.
+class LatencyHistogram {
+public:
+    static const int SUB_BITS = 5;
+    static const int BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+    void record(uint64_t value);
+    void mergeInto(vector<uint64_t>& totals, uint64_t& sum, uint64_t& max_value) const;
+    static int bucketOf(uint64_t value);
+    static uint64_t bucketLow(int bucket);
+
+private:
+    atomic<uint64_t> counts[BUCKETS] = {};
+    atomic<uint64_t> sum{0}, max_value{0};
+};
+
+// Run metrics beyond the per-job counters, enabled with --metrics <prefix>. Each thread records
+// into a shard of its own; the exporter merges the shards. Resident set size is sampled
+// every sample_every references. Between start and stop a background thread rewrites
+// <prefix>.json and <prefix>.prom every interval, and stop writes them a final time.
+struct MetricShard {
+    LatencyHistogram fault_service_ns;  // simulated: the job's stall on the swap device
+    LatencyHistogram reference_ns;      // wall clock spent in referencePage
+};
+
+class Metrics {
+public:
+    void configure(const string& prefix, double interval_seconds, uint64_t sample_every);
+    bool enabled() const { return active; }
+    void start(const vector<JobTableEntry>& jobTable, ReplacementAlgorithm algorithm, int num_frames);
+    void stop();
+    void recordFaultService(uint64_t ns) { threadShard().fault_service_ns.record(ns); }
+    void recordReference(uint64_t ns) { threadShard().reference_ns.record(ns); }
+    void sampleResident(uint64_t now);
+    bool sampleDue(uint64_t now) const { return now % sample_every == 0; }
+
+private:
+    MetricShard& threadShard();
+    void exporterLoop();
+    bool exportFiles();
+    string toJson();
+    string toPrometheus();
+
+    string prefix;
+    double interval = 1.0;
+    uint64_t sample_base = 10000, sample_every = 10000; // the latter doubles as the series is thinned
+    atomic<uint64_t> generation{0};                     // bumped by start, which drops all shards
+    bool active = false;
+    const vector<JobTableEntry>* jobs = nullptr;
+    ReplacementAlgorithm algorithm = ReplacementAlgorithm::LRU;
+    int num_frames = 0, page_size = 0;
+    mutex shards_lock;
+    vector<unique_ptr<MetricShard>> shards;
+    mutex series_lock;                    // guards the resident set size series
+    vector<pair<uint64_t, int64_t>> rss;  // (access_clock, resident pages of all jobs)
+    vector<vector<int64_t>> job_rss;      // per job, only for runs of up to MAX_JOB_SERIES jobs
+    thread exporter;
+    mutex exporter_lock;
+    condition_variable exporter_wake;
+    bool stopping = false;
+};
+
+// Times a reference into the metrics while it is in scope, when metrics are on
+struct ReferenceTimer {
+    Metrics& metrics;
+    chrono::steady_clock::time_point started;
+    bool timing;
+    explicit ReferenceTimer(Metrics& into) : metrics(into), timing(into.enabled()) {
+        if (timing) started = chrono::steady_clock::now();
+    }
+    ~ReferenceTimer() {
+        if (timing) metrics.recordReference((uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - started).count());
+    }
+};
+
+// Swap device the pages are read from and dirty victims written back to. Every job runs on a
+// simulated clock of its own (PagingCounters::clock_ns), so while one job waits for the device
+// the others keep running. The device serves up to queue_depth requests at once; a request
+// takes its latency plus its size over the bandwidth, and waits for a free slot first.
+// Write-backs go through a write-behind buffer: the frame is reused at once and the page is
+// written in clusters of up to `cluster` pages per request, unless sync_writes makes the
+// faulting job wait for every write. A page faulted back in while its write-back is still
+// buffered is served from the buffer, and one whose write is in flight is read after it.
+// Cross-job ordering is approximate in threaded runs, where job clocks drift independently.
+class SwapDevice {
+public:
+    SwapDevice() { configure(100000, 100000, 500, 500, 4, 1, false); }
+
+    // Latencies in ns, bandwidths in MB/s
+    bool configure(uint64_t read_latency, uint64_t write_latency, double read_mb_s, double write_mb_s, int depth, int cluster_pages, bool sync);
+    void configureLike(const SwapDevice& other);
+    void reset(int num_frames);
+    void writeBack(PagingCounters& job, int page_no);
+    void pageIn(PagingCounters& job, int page_no);
+    void prefetchIn(PagingCounters& job, int page_no, int frame_no);
+    void waitReady(PagingCounters& job, int frame_no);
+    void flush(const vector<JobTableEntry>& jobTable);
+    void printStats(const vector<JobTableEntry>& jobTable) const;
+
+private:
+    uint64_t submit(uint64_t at, int pages, bool is_write);
+    uint64_t issueWrites(uint64_t at);
+    static void stallUntil(PagingCounters& job, uint64_t until);
+
+    uint64_t read_latency_ns = 0, write_latency_ns = 0;
+    double read_ns_per_byte = 0, write_ns_per_byte = 0;
+    int queue_depth = 1, cluster = 1;
+    bool sync_writes = false;
+
+    mutable mutex lock;
+    vector<uint64_t> slot_free;               // when each queue slot finishes its last request
+    vector<int> write_buffer;                 // dirty pages waiting for a cluster to fill
+    unordered_map<int, uint64_t> write_done;  // completion of write-backs still in flight
+    vector<uint64_t> ready_at;                // per frame: when its prefetch read completes
+    uint64_t reads = 0, read_requests = 0, writes = 0, write_requests = 0, buffer_hits = 0;
+    uint64_t busy_ns = 0, read_wait_ns = 0;
+};
+
+// Real paging for trace replay (--real-memory, Linux only). The frames are an actual arena of
+// total_memory bytes in a memfd, and the pages of all jobs a PROT_NONE range of address space
+// reserved up front. Replay touches every referenced byte. Touching a page that isn't mapped
+// raises SIGSEGV, whose handler runs the ordinary fault path: the replacement algorithm picks
+// the victim, which is written to the store file if dirty and unmapped, then the page is read
+// from the store into its frame and the frame mapped at the page's address. Hits don't trap,
+// so replay hands them to referencePage after the touch for the policy's bookkeeping.
+class MmapEngine {
+public:
+    void configure(bool on, const string& path) { requested = on; store_path = path; }
+    bool requestedRun() const { return requested; }
+    bool start(int total_pages, int num_frames);
+    void stop();
+    bool active() const { return region != nullptr; }
+    bool reference(Job& job, uint64_t logical_addr, bool is_write, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementState& replacement, int* resolved_frame);
+    bool handleFault(void* address);
+    void load(int page_no, int frame_no);
+    void evict(int page_no, int frame_no, bool dirty);
+    void printStats(uint64_t policy_faults) const;
+
+private:
+    bool requested = false;
+    string store_path;                // empty: an unlinked temporary file
+    uint8_t* region = nullptr;        // page p of any job lives at region + p * page_size
+    size_t region_bytes = 0;
+    uint8_t* frames = nullptr;        // the arena, mapped once more for filling and writing back
+    size_t frames_bytes = 0;
+    int frames_fd = -1, store_fd = -1;
+
+    // The reference in progress, for the fault handler
+    Job* job = nullptr;
+    bool is_write = false;
+    int* resolved = nullptr;
+    FrameTable* pageFrames = nullptr;
+    MemoryMapTable* memoryMapTable = nullptr;
+    vector<JobTableEntry>* jobTable = nullptr;
+    vector<PageTable>* pageMapTables = nullptr;
+    ReplacementState* replacement = nullptr;
+    bool trapped = false, faulted = false;  // set by the handler during the touch
+
+    uint64_t traps = 0, mismatches = 0, bytes_read = 0, bytes_written = 0;
+    LatencyHistogram service_ns;      // wall clock from entering the handler to leaving it
+};
+
+// Binary trace file layout (all fields little-endian):
+//   TraceFileHeader
+//   num_records x uint64_t record   (see encodeTraceRecord)
+//   num_jobs x uint64_t job size in bytes
+// The job table sits after the records so traces can be written in one streaming pass.
+const char TRACE_MAGIC[4] = {'D', 'P', 'T', 'R'};
+const uint32_t TRACE_VERSION = 1;
+
+struct TraceFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t num_jobs;
+    uint32_t reserved;
+    uint64_t num_records;
+};
+
+// One decoded page reference
+struct TraceRecord {
+    uint64_t logical_addr;
+    int job_no;
+    bool is_write;
+};
+
+// Records pack into 8 bytes: bits 0-46 logical address, bits 47-62 job number, bit 63 write flag
+const int TRACE_JOB_SHIFT = 47;
+const uint64_t TRACE_ADDR_MASK = (1ULL << TRACE_JOB_SHIFT) - 1;
+const uint64_t TRACE_JOB_MASK = 0xFFFF;
+const uint64_t TRACE_WRITE_BIT = 1ULL << 63;
+const int TRACE_MAX_JOBS = 1 << 16;
+
+// Streams an array of uint64_t records stored in a file through a sliding read-only
+// mapping, so memory use stays bounded no matter how many records there are
+class RecordStream {
+public:
+    ~RecordStream() { close(); }
+
+    bool open(const string& path, uint64_t data_offset, uint64_t num_records);
+    void close();
+    void seek(uint64_t record_index) { position = record_index; }
+    bool next(uint64_t& raw);
+
+private:
+    bool mapWindow(uint64_t first_record);
+
+    uint64_t data_offset = 0;
+    uint64_t num_records = 0;
+    uint64_t window_first = 0;  // index of the first record in the current window
+    uint64_t window_count = 0;
+    uint64_t position = 0;      // index of the next record to hand out
+    const uint64_t* records = nullptr;
+#ifdef _WIN32
+    ifstream file;
+    vector<uint64_t> buffer;
+#else
+    int fd = -1;
+    void* mapping = nullptr;
+    size_t mapping_length = 0;
+    size_t mapping_skip = 0;    // bytes between the mapping start and the first record of the window
+#endif
+};
+
+// Reads a binary trace: header and job table up front, records streamed
+class TraceReader {
+public:
+    bool open(const string& path);
+    void close() { stream.close(); }
+    void seek(uint64_t record_index) { stream.seek(record_index); }
+    bool next(TraceRecord& record);
+    bool nextRaw(uint64_t& raw) { return stream.next(raw); }
+
+    uint64_t numRecords() const { return header.num_records; }
+    const vector<uint64_t>& jobSizes() const { return job_sizes; }
+
+private:
+    TraceFileHeader header = {};
+    vector<uint64_t> job_sizes;
+    RecordStream stream;
+};
+
+// Next-use index for Belady's OPT: a sidecar file "<trace>.nextuse" holding, for every
+// trace record, the index of the next record referencing the same page (NEVER_USED_AGAIN
+// if there is none). It depends on the page size, which is stored in its header.
+const char NEXT_USE_MAGIC[4] = {'D', 'P', 'N', 'U'};
+const uint64_t NEVER_USED_AGAIN = UINT64_MAX;
+
+struct NextUseFileHeader {
+    char magic[4];
+    uint32_t page_size;
+    uint64_t num_records;
+};
+
+// Appends records to a trace file and patches the header and job table on close
+class TraceWriter {
+public:
+    bool open(const string& path);
+    void write(uint64_t logical_addr, int job_no, bool is_write);
+    bool close(const vector<uint64_t>& job_sizes);
+
+private:
+    ofstream file;
+    vector<uint64_t> buffer;
+    uint64_t num_records = 0;
+};
+
+// Workload generators for the simulation and --generate-trace. Every job draws from a
+// generator of its own, so job threads share no random state and a run is reproducible from
+// --seed. The models:
+//   uniform     every page equally likely (the original simulation)
+//   zipf        page i with probability proportional to 1 / (i + 1)^theta, page 0 hottest
+//   sequential  a scan through the job, wrapping at its end
+//   loop        a scan over the first --workload-window pages, over and over
+//   stride      every --stride-th page, shifted by one page on each wrap so all pages are seen
+//   hotcold     --hot-probability of the references go to the first --hot-fraction of pages
+//   phase       uniform within a window of --workload-window pages that moves to a random
+//               place every --phase-length references
+enum class WorkloadModel { UNIFORM, ZIPF, SEQUENTIAL, LOOP, STRIDE, HOT_COLD, PHASE };
+
+struct WorkloadSettings {
+    WorkloadModel model = WorkloadModel::UNIFORM;
+    uint64_t references = 0;        // per job; 0 references every job once per page
+    uint64_t seed = 1;
+    double write_ratio = 0.25;
+    double zipf_theta = 0.99;       // in (0, 1)
+    int window = 0;                 // loop and phase; 0 is a quarter of the job
+    int stride = 4;
+    double hot_fraction = 0.1, hot_probability = 0.9;
+    uint64_t phase_length = 10000;
+};
+
+// How the simulation shares the CPU between jobs (see JobScheduler)
+struct SchedulerSettings {
+    uint64_t quantum = 100;         // references per time slice
+    int workers = 0;                // worker threads; 0 is one per core
+    int max_active = 0;             // jobs admitted at once; 0 admits them all
+    vector<int> priorities;         // per job in job order; jobs past the end get 1
+    bool reproducible = true;       // one slice at a time, so a run depends on the seed alone
+};
+
+// Settings of one simulation. The command line sets the main context's; a --sweep point
+// starts from a copy of them and changes its own grid coordinates.
+struct SimulatorSettings {
+    int page_size = 200;            // Page size and page frame size
+    int total_memory = 2000;        // Total memory available
+    int page_table_levels = 1;      // 1 for flat PMTs, 2-4 for radix page tables allocated on first touch
+    uint64_t reference_ns = 100;    // Simulated CPU time of one page reference
+    int prefetch_window = 0;        // Largest read-ahead in pages; 0 turns prefetching off
+    int prefetch_max_stride = 16;   // Larger strides between faults are not taken for a stream
+    int huge_page_pages = 0;        // Base pages per huge page, a power of two; 0 turns huge pages off
+    double huge_promote_density = 0.5;    // Share of a region's pages referenced in a scan that promotes it
+    double huge_demote_density = 0.125;   // ... and below which a huge page is split again
+    FrameAllocation frame_allocation = FrameAllocation::GLOBAL;
+    uint64_t ws_window = 1000;
+    uint64_t pff_interval = 100;
+    bool load_control = true;
+    WorkloadSettings workload;      // configured with --workload and its options
+    SchedulerSettings scheduler;    // configured with --quantum, --max-active, --priorities and --threads
+};
+
+// One simulation: its settings, its logical clock and the devices its jobs share
+struct SimulatorContext : SimulatorSettings {
+    atomic<uint64_t> access_clock{0}; // Logical time, advanced once per page reference
+    Tlb tlb;                    // Shared by all jobs; configured with --tlb-entries, --tlb-ways and --tlb-policy
+    EventLog event_log;         // configured with --log-level, --log-format and --log-file
+    Metrics metrics;
+    SwapDevice swap;            // configured with the --swap-* options
+    MmapEngine mmap_engine;     // configured with --real-memory and --store
+};
+
+SimulatorContext MAIN_CONTEXT;
+thread_local SimulatorContext* SIM = &MAIN_CONTEXT;
+
+// xoshiro256** by Blackman and Vigna: four words of state and a few instructions a number.
+// Seeded through splitmix64, as its authors recommend, so similar seeds give unrelated streams.
+class Xoshiro256 {
+public:
+    explicit Xoshiro256(uint64_t seed);
+    uint64_t next();
+    uint64_t below(uint64_t bound);   // uniform in [0, bound), bound > 0
+    double unit();                    // uniform in [0, 1)
+
+private:
+    uint64_t state[4];
+};
+
+// Page references of one job under workload; stream tells the jobs' generators apart
+class WorkloadGenerator {
+public:
+    WorkloadGenerator(const WorkloadSettings& settings, int num_pages, uint64_t stream);
+    int nextPage();
+    bool nextIsWrite() { return random.unit() < settings.write_ratio; }
+    Xoshiro256& rng() { return random; }
+
+private:
+    const WorkloadSettings& settings;
+    Xoshiro256 random;
+    int num_pages;
+    int window;
+    uint64_t count = 0;
+    int position = 0, base = 0, lap = 0;
+    double zeta_n = 0, alpha = 0, eta = 0, half_pow_theta = 0;  // zipf
+};
+
+// Runs a batch of independent tasks on a fixed set of threads. Every thread owns a deque: it
+// takes tasks from the back of its own and, once that is empty, steals from the front of the
+// others', so threads that drew short tasks help out those that drew long ones.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(int num_threads);
+    void submit(function<void()> task);   // only before run
+    void run();                           // returns when every task has run
+
+private:
+    struct TaskQueue {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+    bool take(int self, function<void()>& task);
+
+    vector<unique_ptr<TaskQueue>> queues;
+    size_t submitted = 0;
+};
+
+// Multiprogramming for the simulation: jobs run in time slices of up to quantum references on
+// a fixed set of workers. The next slice goes to the admitted job with the lowest pass (stride
+// scheduling): a slice advances a job's pass by a stride inversely proportional to its
+// priority, so a job of priority 2 gets twice the slices of one of priority 1 and no job
+// starves. At most max_active jobs are admitted at once; the rest wait in priority order, with
+// ties between equal priorities broken by an order drawn from the workload seed. Jobs that
+// load control suspended are passed over until their resident set fits into free memory.
+// No more slices run at once than there are frames, as each can have a fault loading.
+class JobScheduler {
+public:
+    JobScheduler(vector<Job>& jobs, const SchedulerSettings& settings, uint64_t seed, int num_frames);
+    int workers() const { return num_workers; }
+    const vector<int>& priorityOrder() const { return admission_order; }   // highest priority first
+    void start();
+    // Block until a slice can run; returns its job and how many references it makes, or -1 once
+    // every job has finished. Idle workers count as waiting for load control.
+    int next(MemoryMapTable& memoryMapTable, ReplacementState& replacement, uint64_t& references);
+    void finish(int job_no, uint64_t references);
+    uint64_t referencesRun() const { return references_run; }
+    WorkloadGenerator& workload(int job_no) { return *entries[job_no].workload; }
+    void printStats() const;
+
+private:
+    struct Entry {
+        unique_ptr<WorkloadGenerator> workload;   // created on admission
+        uint64_t remaining = 0;                   // references left to make
+        int priority = 1;
+        uint64_t stride = 0, pass = 0;
+        uint64_t slices = 0, admitted_at = 0, finished_at = 0;   // access clock
+    };
+    void admit();
+    bool runnable(int job_no, MemoryMapTable& memoryMapTable, ReplacementState& replacement, bool force);
+
+    vector<Job>& jobs;
+    SchedulerSettings settings;
+    vector<Entry> entries;
+    vector<int> admission_order;
+    vector<uint64_t> tie_break;              // seeded; orders jobs of equal priority or pass
+    set<tuple<uint64_t, uint64_t, int>> ready;   // (pass, tie break, job) of admitted jobs waiting for a slice
+    mutex lock;
+    condition_variable changed;
+    uint64_t generation = 0;                 // bumped whenever a slice finishes
+    size_t next_admission = 0;
+    int num_workers = 1, max_in_flight = 1, in_flight = 0, active = 0, finished = 0;
+    uint64_t current_pass = 0, total_slices = 0, references_run = 0;
+};
+
+// One point of a --sweep grid and what its simulation measured
+struct SweepPoint {
+    ReplacementAlgorithm algorithm;
+    WorkloadModel workload;
+    int frames, page_size;
+    uint64_t references = 0, faults = 0, evictions = 0, dirty_evictions = 0, prefetches = 0;
+    uint64_t tlb_hits = 0, tlb_misses = 0, makespan_ns = 0, stall_ns = 0;
+    double seconds = 0;
 };
 
 // Function declarations
 void acceptJobs(int n, vector<Job>& jobs);
-void moveJobsToPages(vector<Job>& jobs, vector<JobTableEntry>& jobTable, vector<vector<PageMapTableEntry>>& pageMapTables);
-void processJobs(vector<Job>& jobs, vector<PageFrame>& pageFrames, vector<MemoryMapTableEntry>& memoryMapTable, vector<JobTableEntry>& jobTable, vector<vector<PageMapTableEntry>>& pageMapTables);
-void processIndividualJob(Job& job, vector<PageFrame>& pageFrames, vector<MemoryMapTableEntry>& memoryMapTable, vector<JobTableEntry>& jobTable, vector<vector<PageMapTableEntry>>& pageMapTables, const string& algorithm);
-PageMapTableEntry& getPageMapTableEntryByPageNumber(int page_no, vector<PageMapTableEntry>& pageMapTable);
-int findFrameToReplace(vector<PageFrame>& pageFrames, const string& algorithm);
-void addressResolution(int logical_addr, int page_size, int frame_no);
-void printMemoryState(const vector<PageFrame>& pageFrames);
-
-// Main program
-int main() {
+void moveJobsToPages(vector<Job>& jobs, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables);
+void simulateJobs(vector<Job>& jobs, ReplacementAlgorithm algorithm);
+void processJobs(vector<Job>& jobs, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementAlgorithm algorithm);
+void runScheduledJobs(vector<Job>& jobs, JobScheduler& scheduler, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementState& replacement);
+void runTimeSlice(Job& job, WorkloadGenerator& workload, uint64_t references, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementState& replacement);
+PageMapTableEntry& getPageMapTableEntryByPageNumber(int page_no, const JobTableEntry& jobTableEntry, vector<PageTable>& pageMapTables);
+int findFrameToReplace(FrameTable& pageFrames, ReplacementState& replacement, const PageFault& fault);
+int countTrailingZeros(uint64_t word);
+int highestSetBit(uint64_t word);
+bool tracksHits(ReplacementAlgorithm algorithm);
+bool parseLogLevel(const string& name, LogLevel& level);
+bool parseLogFormat(const string& name, LogFormat& format);
+int clockSweep(FrameTable& pageFrames, ReplacementState& replacement);
+int enhancedClockSweep(FrameTable& pageFrames, ReplacementState& replacement);
+void initReplacementState(ReplacementState& replacement, ReplacementAlgorithm algorithm, int num_frames);
+void initLocalAllocation(ReplacementState& replacement, int num_jobs, int num_threads);
+bool unmapFrame(FrameTable& pageFrames, vector<JobTableEntry>& jobTable, int frame_no, int for_job, uint64_t now);
+void releaseFrame(FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, ReplacementState& replacement, int job_no, int frame_no);
+int localClaimFrame(int job_no, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, ReplacementState& replacement, bool& dirty_victim);
+void setLocalPriorities(ReplacementState& replacement, const vector<int>& priority_order);
+void waitUntilResumed(int job_no, MemoryMapTable& memoryMapTable, ReplacementState& replacement);
+void resumeJob(int job_no, ReplacementState& replacement);
+void localWorkerIdle(ReplacementState& replacement, bool idle);
+void localThreadFinished(ReplacementState& replacement);
+void initPrefetch(ReplacementState& replacement, int num_jobs);
+void readAhead(Job& job, int page_index, bool on_hit, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementState& replacement);
+bool prefetchPage(Job& job, int page_index, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementState& replacement);
+void printPrefetchStats(const vector<JobTableEntry>& jobTable);
+void initHugePages(ReplacementState& replacement, const vector<Job>& jobs, int num_frames);
+int hugeTlbTag(int region);
+HugeRegion* hugeRegionOf(ReplacementState& replacement, int job_no, int page_index);
+void hugeReferenced(ReplacementState& replacement, PagingCounters& counters, HugeRegion* region, PageMapTableEntry& row, uint64_t before, int frame_no);
+int hugeClaimFrame(int job_no, int page_index, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, ReplacementState& replacement);
+void hugeFrameTaken(int frame_no, FrameTable& pageFrames, vector<JobTableEntry>& jobTable, MemoryMapTable& memoryMapTable, ReplacementState& replacement);
+void breakReservation(int index, MemoryMapTable& memoryMapTable, ReplacementState& replacement, FrameTable& pageFrames);
+void demoteRegion(int job_no, int region, ReplacementState& replacement);
+bool promoteRegion(int job_no, int region, FrameTable& pageFrames, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementState& replacement);
+void scanHugeRegions(FrameTable& pageFrames, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementState& replacement);
+void printHugePageStats(const vector<Job>& jobs, const ReplacementState& replacement);
+bool parseFrameAllocation(const string& name, FrameAllocation& mode);
+const char* frameAllocationName(FrameAllocation mode);
+void onPageFault(ReplacementState& replacement, PageFault& fault);
+void onFrameLoaded(FrameTable& pageFrames, ReplacementState& replacement, int frame_no, const PageFault& fault);
+int arcReplace(FrameTable& pageFrames, ArcState& arc, const PageFault& fault);
+int twoQReplace(FrameTable& pageFrames, TwoQState& twoQ);
+int lirsReplace(LirsState& lirs);
+int optReplace(OptState& opt);
+void optSetNextUse(OptState& opt, int frame_no);
+void lirsPruneStack(LirsState& lirs);
+void lirsDemoteBottom(LirsState& lirs);
+void printReplacementStats(const ReplacementState& replacement);
+void printPageTableStats(const vector<JobTableEntry>& jobTable, const vector<PageTable>& pageMapTables);
+PagingCounters totalCounters(const vector<JobTableEntry>& jobTable);
+void onFrameReferenced(FrameTable& pageFrames, ReplacementState& replacement, int frame_no);
+void frameListPushBack(FrameList& list, FrameTable& pageFrames, int frame_no);
+void frameListRemove(FrameList& list, FrameTable& pageFrames, int frame_no);
+bool parseAlgorithm(const string& name, ReplacementAlgorithm& algorithm);
+const char* algorithmName(ReplacementAlgorithm algorithm);
+string addressResolution(uint64_t logical_addr, int page_size, int frame_no);
+void translateBatch(const JobTableEntry& job, vector<PageTable>& pageMapTables, const uint64_t* logical, size_t count, int64_t* physical);
+bool referencePage(Job& job, int page_index, bool is_write, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementState& replacement, int* resolved_frame = nullptr);
+bool parseTlbReplacement(const string& name, TlbReplacement& policy);
+const char* tlbReplacementName(TlbReplacement policy);
+uint64_t encodeTraceRecord(uint64_t logical_addr, int job_no, bool is_write);
+TraceRecord decodeTraceRecord(uint64_t raw);
+bool importLackeyTrace(const vector<string>& inputs, const string& output, int page_size);
+bool importPlainTrace(const string& input, const string& output);
+int replayTrace(const string& path, ReplacementAlgorithm algorithm);
+bool parseWorkloadModel(const string& name, WorkloadModel& model);
+const char* workloadModelName(WorkloadModel model);
+void generateWorkload(const vector<uint64_t>& job_sizes, const function<void(int, uint64_t, bool)>& emit);
+bool generateTrace(const string& output, const vector<uint64_t>& job_sizes);
+void runSweepPoint(SweepPoint& point, const SimulatorContext& base, const vector<uint64_t>& job_sizes);
+int runSweep(const vector<uint64_t>& job_sizes, const vector<ReplacementAlgorithm>& algorithms, const vector<int>& frame_counts,
+             const vector<int>& page_sizes, const vector<WorkloadModel>& workloads, int num_threads, const string& csv_path);
+int analyzeStackDistances(const string& path, int max_frames, const string& curve_path);
+uint64_t tracePageKey(const TraceRecord& record, const PageGeometry& geometry);
+bool buildNextUseIndex(const string& trace_path, int page_size);
+bool openNextUseIndex(const string& trace_path, int page_size, RecordStream& stream);
+void initPageFrames(int num_page_frames, FrameTable& pageFrames, MemoryMapTable& memoryMapTable);
+double runStressWorkload(int num_threads, uint64_t references_per_thread, ReplacementAlgorithm algorithm, bool check, int num_page_frames);
+double runSchedulerStress(int num_threads, uint64_t references_per_thread, ReplacementAlgorithm algorithm);
+int validateMemoryState(FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementState& replacement, uint64_t references);
+int runStressTest(int num_threads, uint64_t references_per_thread, ReplacementAlgorithm algorithm);
+int runScalingBenchmark(int max_threads, uint64_t total_references, ReplacementAlgorithm algorithm);
+int runBatch(int argc, char* argv[]);
+void printUsage(const char* program);
+
+// Main program. PagingBenchmark.cpp includes this file with PAGING_NO_MAIN and brings its own.
+#ifndef PAGING_NO_MAIN
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        return runBatch(argc, argv);
+    }
+
+
     vector<Job> jobs;
     int n;
 
@@ -82,35 +1108,57 @@ int main() {
 
     acceptJobs(n, jobs);
 
-    int num_page_frames = ceil((float)TOTAL_MEMORY / PAGE_SIZE);
-    vector<PageFrame> pageFrames(num_page_frames);
-    vector<JobTableEntry> jobTable(n);
-    vector<MemoryMapTableEntry> memoryMapTable;
-    vector<vector<PageMapTableEntry>> pageMapTables;
-
-    // Create memory frames and initialize times
-    for (int i = 0; i < num_page_frames; ++i) {
-        pageFrames[i].page_frame_no = i;
-        pageFrames[i].is_occupied = false;
-        pageFrames[i].time_loaded = 0;
-        pageFrames[i].last_used = 0;
+    cout << "\nChoose page replacement algorithm (FIFO/LRU/CLOCK/SC/ECLOCK/ARC/2Q/LIRS): ";
+    string algorithm;
+    cin >> algorithm;
 
-        MemoryMapTableEntry entry;
-        entry.page_frame_no = i;
-        entry.is_occupied = false;
-        memoryMapTable.push_back(entry);
+    ReplacementAlgorithm chosen;
+    if (!parseAlgorithm(algorithm, chosen)) {
+        chosen = ReplacementAlgorithm::LRU;
     }
+    if (chosen == ReplacementAlgorithm::OPT) {
+        cout << "OPT needs the future reference string; it is only available with --replay. Using LRU.\n";
+        chosen = ReplacementAlgorithm::LRU;
+    }
+    simulateJobs(jobs, chosen);
+
+    return 0;
+}
+#endif
+
+// Run the threaded simulation of jobs, one thread per job, in a memory of total_memory.
+// Shared by the interactive program and --simulate.
+void simulateJobs(vector<Job>& jobs, ReplacementAlgorithm algorithm) {
+    int num_page_frames = ceil((float)SIM->total_memory / SIM->page_size);
+    FrameTable pageFrames;
+    vector<JobTableEntry> jobTable(jobs.size());
+    MemoryMapTable memoryMapTable;
+    vector<PageTable> pageMapTables;
+
+    // Create memory frames and initialize times
+    initPageFrames(num_page_frames, pageFrames, memoryMapTable);
 
     moveJobsToPages(jobs, jobTable, pageMapTables);
-    processJobs(jobs, pageFrames, memoryMapTable, jobTable, pageMapTables);
+    processJobs(jobs, pageFrames, memoryMapTable, jobTable, pageMapTables, algorithm);
+}
 
-    return 0;
+// Create empty frames and mark them all free in the Memory Map Table
+void initPageFrames(int num_page_frames, FrameTable& pageFrames, MemoryMapTable& memoryMapTable) {
+    pageFrames.busy = vector<atomic<bool>>(num_page_frames);
+    pageFrames.job_no.assign(num_page_frames, -1);
+    pageFrames.page_no.assign(num_page_frames, -1);
+    pageFrames.owner.assign(num_page_frames, nullptr);
+    pageFrames.last_used = vector<atomic<uint64_t>>(num_page_frames);
+    pageFrames.prev.assign(num_page_frames, -1);
+    pageFrames.next.assign(num_page_frames, -1);
+    pageFrames.queue_id.assign(num_page_frames, 0);
+    memoryMapTable.init(num_page_frames);
 }
 
 // Accept Jobs
 void acceptJobs(int n, vector<Job>& jobs) {
     for (int i = 0; i < n; ++i) {
-        int size;
+        uint64_t size;
         Job job;
         cout << "Enter the size of job " << i + 1 << ": ";
         cin >> size;
@@ -121,13 +1169,14 @@ void acceptJobs(int n, vector<Job>& jobs) {
 }
 
 // Divide jobs into pages and create PMT and Job Table
-void moveJobsToPages(vector<Job>& jobs, vector<JobTableEntry>& jobTable, vector<vector<PageMapTableEntry>>& pageMapTables) {
+void moveJobsToPages(vector<Job>& jobs, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables) {
     int pageNo = 0;
     for (int i = 0; i < (int)jobs.size(); ++i) {
         auto& job = jobs[i];
         JobTableEntry jobTableEntry;
         jobTableEntry.job_no = job.number;
         jobTableEntry.PMT_ID = i;
+        jobTableEntry.first_page_no = pageNo;
         // Save to jobTable 
         if (i < (int)jobTable.size()) {
             jobTable[i] = jobTableEntry;
@@ -135,54 +1184,175 @@ void moveJobsToPages(vector<Job>& jobs, vector<JobTableEntry>& jobTable, vector<
             jobTable.push_back(jobTableEntry);
         }
 
-        vector<PageMapTableEntry> pageMapTable;
-
-        int num_pages = ceil((float)job.size / PAGE_SIZE);
+        // Page numbers are ints, so a job's address space is capped at INT32_MAX pages
+        uint64_t num_pages = pagesFor(job.size, SIM->page_size);
         if (num_pages == 0) num_pages = 1;
-        for (int j = 0; j < num_pages; ++j) {
-            PageMapTableEntry PMT_Entry;
-            Page newPage;
-            newPage.job_number = job.number;
-            newPage.page_no = pageNo;
-            newPage.size_of_content = (j == num_pages - 1) ? (job.size % PAGE_SIZE == 0 ? PAGE_SIZE : job.size % PAGE_SIZE) : PAGE_SIZE;
-            job.pages.push_back(newPage);
+        job.num_pages = (int)min<uint64_t>(num_pages, INT32_MAX - pageNo);
+        pageNo += job.num_pages;
+    }
+
+    // Entries are created by the page tables themselves: all at once when flat, on first
+    // touch otherwise
+    pageMapTables = vector<PageTable>(jobs.size());
+    for (int i = 0; i < (int)jobs.size(); ++i) {
+        pageMapTables[i].init(jobTable[i].first_page_no, jobs[i].num_pages, SIM->page_table_levels);
+    }
+}
+
+// Finding page in PMT. Callers pass a page of the job, so this is a page walk with no search.
+PageMapTableEntry& getPageMapTableEntryByPageNumber(int page_no, const JobTableEntry& jobTableEntry, vector<PageTable>& pageMapTables) {
+    return pageMapTables[jobTableEntry.PMT_ID].entry(page_no - jobTableEntry.first_page_no);
+}
 
-            PMT_Entry.page_no = pageNo;
-            PMT_Entry.page_frame_no = -1;
-            PMT_Entry.status = false;
-            PMT_Entry.modified = false;
-            PMT_Entry.referenced = false;
-            PMT_Entry.time_loaded = 0;
-            PMT_Entry.last_used = 0;
+void PageTable::init(int first_page, int pages, int levels) {
+    freeTable(root, 0);
+    first_page_no = first_page;
+    num_pages = max(1, pages);
+    num_levels = max(1, min(4, levels));
+    num_walks = 0;
+    if (num_levels == 1) {
+        bits_per_level = 0;
+        root_fanout = num_pages;
+    } else {
+        int vpn_bits = 1;
+        while (vpn_bits < 31 && (num_pages - 1) >> vpn_bits) vpn_bits++;
+        bits_per_level = (vpn_bits + num_levels - 1) / num_levels;
+        root_fanout = ((num_pages - 1) >> ((num_levels - 1) * bits_per_level)) + 1;
+    }
+    root = allocateTable(0);
+}
 
-            pageMapTable.push_back(PMT_Entry);
-            pageNo++;
+PageMapTableEntry& PageTable::entry(int vpn) {
+    num_walks.fetch_add(1, memory_order_relaxed);
+    void* table = root;
+    for (int level = 0; level + 1 < num_levels; ++level) {
+        atomic<void*>& slot = static_cast<atomic<void*>*>(table)[indexAt(vpn, level)];
+        void* next = slot.load(memory_order_acquire);
+        if (!next) {
+            void* fresh = allocateTable(level + 1);
+            if (slot.compare_exchange_strong(next, fresh, memory_order_acq_rel)) next = fresh;
+            else freeTable(fresh, level + 1); // another walk installed one first; next holds it
         }
-        pageMapTables.push_back(pageMapTable);
+        table = next;
     }
+    return static_cast<PageMapTableEntry*>(table)[indexAt(vpn, num_levels - 1)];
 }
 
-// Finding page in PMT
-PageMapTableEntry& getPageMapTableEntryByPageNumber(int page_no, vector<PageMapTableEntry>& pageMapTable) {
-    for (auto& row : pageMapTable) {
-        if (row.page_no == page_no)
-            return row;
+PageMapTableEntry* PageTable::find(int vpn) const {
+    void* table = root;
+    for (int level = 0; level + 1 < num_levels && table; ++level) {
+        table = static_cast<atomic<void*>*>(table)[indexAt(vpn, level)].load(memory_order_acquire);
     }
-    throw runtime_error("Page not found in PMT!");
+    return table ? &static_cast<PageMapTableEntry*>(table)[indexAt(vpn, num_levels - 1)] : nullptr;
 }
 
-// Process all jobs
-void processJobs(vector<Job>& jobs, vector<PageFrame>& pageFrames, vector<MemoryMapTableEntry>& memoryMapTable, vector<JobTableEntry>& jobTable, vector<vector<PageMapTableEntry>>& pageMapTables) {
-    cout << "\nChoose page replacement algorithm (FIFO/LRU): ";
-    string algorithm;
-    cin >> algorithm;
+// Visit every entry that exists, skipping the padding past the job's last page
+void PageTable::forEachEntry(const function<void(int, PageMapTableEntry&)>& visit) {
+    forEachIn(root, 0, 0, visit);
+}
+
+void PageTable::forEachIn(void* table, int level, int base, const function<void(int, PageMapTableEntry&)>& visit) {
+    if (!table) return;
+    int shift = (num_levels - 1 - level) * bits_per_level;
+    for (int i = 0; i < fanout(level); ++i) {
+        int vpn = base + (i << shift);
+        if (vpn >= num_pages) break;
+        if (level + 1 == num_levels) visit(first_page_no + vpn, static_cast<PageMapTableEntry*>(table)[i]);
+        else forEachIn(static_cast<atomic<void*>*>(table)[i].load(memory_order_acquire), level + 1, vpn, visit);
+    }
+}
+
+// Allocate an empty table for a level; a zero PMT entry is an unmapped page
+void* PageTable::allocateTable(int level) {
+    int n = fanout(level);
+    num_tables++;
+    if (level + 1 < num_levels) {
+        table_bytes += n * sizeof(atomic<void*>);
+        return new atomic<void*>[n]();
+    }
+    table_bytes += n * sizeof(PageMapTableEntry);
+    return new PageMapTableEntry[n];
+}
+
+void PageTable::freeTable(void* table, int level) {
+    if (!table) return;
+    int n = fanout(level);
+    num_tables--;
+    if (level + 1 < num_levels) {
+        atomic<void*>* children = static_cast<atomic<void*>*>(table);
+        for (int i = 0; i < n; ++i) freeTable(children[i].load(), level + 1);
+        table_bytes -= n * sizeof(atomic<void*>);
+        delete[] children;
+    } else {
+        table_bytes -= n * sizeof(PageMapTableEntry);
+        delete[] static_cast<PageMapTableEntry*>(table);
+    }
+}
+
+// Print page-table memory and walks per job, against what flat PMTs would take
+void printPageTableStats(const vector<JobTableEntry>& jobTable, const vector<PageTable>& pageMapTables) {
+    const int MAX_JOBS_LISTED = 16;
+    size_t total = 0, flat = 0;
+    uint64_t walks = 0;
+    for (int i = 0; i < (int)jobTable.size(); ++i) {
+        const PageTable& table = pageMapTables[jobTable[i].PMT_ID];
+        size_t flat_bytes = (size_t)table.numPages() * sizeof(PageMapTableEntry);
+        total += table.bytes();
+        flat += flat_bytes;
+        walks += table.walks();
+        if (i < MAX_JOBS_LISTED) {
+            cout << "  Job " << jobTable[i].job_no + 1 << ": " << table.numPages() << " pages, walk depth " << table.levels()
+                 << ", " << table.walks() << " walks, " << table.tables() << " tables, " << table.bytes() << " bytes (flat "
+                 << flat_bytes << ")\n";
+        }
+    }
+    if ((int)jobTable.size() > MAX_JOBS_LISTED) cout << "  ... " << jobTable.size() - MAX_JOBS_LISTED << " more jobs\n";
+    cout << "Page tables: " << total << " bytes for " << walks << " walks (flat PMTs would take " << flat << " bytes)\n";
+}
 
-    cout << "Using algorithm: " << algorithm << "\n";
+// Process all jobs: a fixed set of workers runs their time slices as the scheduler hands them out
+void processJobs(vector<Job>& jobs, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementAlgorithm chosen) {
+    JobScheduler scheduler(jobs, SIM->scheduler, SIM->workload.seed, (int)pageFrames.size());
+    ReplacementState replacement;
+    initReplacementState(replacement, chosen, (int)pageFrames.size());
+    initLocalAllocation(replacement, (int)jobs.size(), scheduler.workers());
+    setLocalPriorities(replacement, scheduler.priorityOrder());
+    initPrefetch(replacement, (int)jobs.size());
+    initHugePages(replacement, jobs, (int)pageFrames.size());
+    cout << "Using algorithm: " << algorithmName(replacement.algorithm) << "\n";
+    SIM->tlb.flush();
+    SIM->swap.reset((int)pageFrames.size());
+    SIM->event_log.start();
+    SIM->metrics.start(jobTable, replacement.algorithm, (int)pageFrames.size());
+    runScheduledJobs(jobs, scheduler, pageFrames, memoryMapTable, jobTable, pageMapTables, replacement);
+    SIM->swap.flush(jobTable);
+    SIM->event_log.stop();
+    SIM->metrics.stop();
+    scheduler.printStats();
+    printReplacementStats(replacement);
+    printPrefetchStats(jobTable);
+    printHugePageStats(jobs, replacement);
+    SIM->swap.printStats(jobTable);
+    SIM->tlb.printStats();
+    printPageTableStats(jobTable, pageMapTables);
+}
 
+// Start the scheduler and run its slices on its workers until every job is done
+void runScheduledJobs(vector<Job>& jobs, JobScheduler& scheduler, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementState& replacement) {
+    scheduler.start();
     vector<thread> threads;
+    SimulatorContext* context = SIM;
 
-    for (auto& job : jobs) {
-        threads.push_back(thread(processIndividualJob, ref(job), ref(pageFrames), ref(memoryMapTable), ref(jobTable), ref(pageMapTables), cref(algorithm)));
+    for (int w = 0; w < scheduler.workers(); ++w) {
+        threads.push_back(thread([&, context]() {
+            SIM = context;
+            uint64_t references = 0;
+            for (int job_no; (job_no = scheduler.next(memoryMapTable, replacement, references)) != -1;) {
+                runTimeSlice(jobs[job_no], scheduler.workload(job_no), references, pageFrames, memoryMapTable, jobTable, pageMapTables, replacement);
+                scheduler.finish(job_no, references);
+            }
+            localThreadFinished(replacement);
+        }));
     }
 
     for (auto& t : threads) {
@@ -190,159 +1360,4198 @@ void processJobs(vector<Job>& jobs, vector<PageFrame>& pageFrames, vector<Memory
     }
 }
 
-// Process individual job
-void processIndividualJob(Job& job, vector<PageFrame>& pageFrames, vector<MemoryMapTableEntry>& memoryMapTable, vector<JobTableEntry>& jobTable, vector<vector<PageMapTableEntry>>& pageMapTables, const string& algorithm) {
+// Run one time slice of a job: references from the job's own generator. Jobs run concurrently
+// when slices overlap; referencePage does its own fine-grained locking.
+void runTimeSlice(Job& job, WorkloadGenerator& workload, uint64_t references, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementState& replacement) {
+    for (uint64_t access = 0; access < references; ++access) {
+        int page_index = workload.nextPage();
+        uint64_t size_of_content = min<uint64_t>(SIM->page_size, job.size - (uint64_t)page_index * SIM->page_size);
+        uint64_t logical_address = (uint64_t)page_index * SIM->page_size + workload.rng().below(size_of_content);
+        int frame_no = -1;
+        bool is_write = workload.nextIsWrite();
+        referencePage(job, page_index, is_write, pageFrames, memoryMapTable, jobTable, pageMapTables, replacement, &frame_no);
 
-    // lock_guard to avoid data races on shared structures 
-    lock_guard<mutex> lock(mtx);
-    srand((unsigned)time(0) + job.number);
+        // Log address resolution with the frame the reference was translated to (through the
+        // TLB, or the PMT on a TLB miss); the writer prints the frames that changed
+        if (SIM->event_log.logs(LogLevel::ALL)) SIM->event_log.emit(LogEventType::RESOLVE, SIM->access_clock, job.number, page_index, frame_no, logical_address);
+    }
+}
 
-    cout << "\nJob " << job.number + 1 << " is running...\n";
-    if (job.pages.empty()) {
-        cout << "Job " << job.number << " has no pages (size 0). Skipping.\n";
-        return;
+JobScheduler::JobScheduler(vector<Job>& jobs, const SchedulerSettings& settings, uint64_t seed, int num_frames)
+    : jobs(jobs), settings(settings), entries(jobs.size()), tie_break(jobs.size()) {
+    const uint64_t STRIDE_SCALE = 1 << 20;
+    Xoshiro256 random(seed ^ 0x5C4ED01E);
+    for (int i = 0; i < (int)jobs.size(); ++i) {
+        entries[i].priority = i < (int)settings.priorities.size() ? settings.priorities[i] : 1;
+        entries[i].stride = STRIDE_SCALE / entries[i].priority;
+        tie_break[i] = random.next();
+        admission_order.push_back(i);
     }
+    sort(admission_order.begin(), admission_order.end(), [&](int a, int b) {
+        if (entries[a].priority != entries[b].priority) return entries[a].priority > entries[b].priority;
+        return tie_break[a] < tie_break[b];
+    });
 
-    for (int access = 0; access < (int)job.pages.size(); ++access) {
-        vector<PageMapTableEntry>& pageMapTable = pageMapTables[jobTable[job.number].PMT_ID];
-        int randomPageIndex = rand() % job.pages.size();
+    int cap = settings.max_active > 0 ? settings.max_active : (int)jobs.size();
+    int cores = settings.workers > 0 ? settings.workers : (int)thread::hardware_concurrency();
+    num_workers = max(1, min({cores, cap, (int)jobs.size()}));
+    max_in_flight = settings.reproducible ? 1 : max(1, min(num_workers, num_frames));
+}
 
-        Page requestedPage = job.pages[randomPageIndex];
-        cout << "Requesting Page " << requestedPage.page_no << " of Job " << job.number + 1 << endl;
+// Admit the first jobs; call once the event log runs
+void JobScheduler::start() {
+    lock_guard<mutex> guard(lock);
+    admit();
+}
 
-        // Find page in PMT
-        PageMapTableEntry& row = getPageMapTableEntryByPageNumber(requestedPage.page_no, pageMapTable);
+// Admit waiting jobs while there is room. A job starts at the current pass, so the time it
+// waited does not buy it a run of slices.
+void JobScheduler::admit() {
+    int cap = settings.max_active > 0 ? settings.max_active : (int)jobs.size();
+    while (active < cap && next_admission < admission_order.size()) {
+        int job_no = admission_order[next_admission++];
+        Job& job = jobs[job_no];
+        Entry& entry = entries[job_no];
+        entry.workload.reset(new WorkloadGenerator(SIM->workload, job.num_pages, job.number));
+        entry.remaining = job.size == 0 ? 0 : SIM->workload.references > 0 ? SIM->workload.references : job.num_pages;
+        entry.pass = current_pass;
+        entry.admitted_at = SIM->access_clock;
+        if (SIM->event_log.logs(LogLevel::FAULTS)) SIM->event_log.emit(LogEventType::JOB, SIM->access_clock, job.number, -1, -1, job.size == 0 ? 0 : job.num_pages);
+        if (entry.remaining == 0) {
+            entry.finished_at = entry.admitted_at;
+            finished++;
+            continue;
+        }
+        active++;
+        ready.insert(make_tuple(entry.pass, tie_break[job_no], job_no));
+    }
+}
 
-        if (row.status && row.page_frame_no >= 0) {
-            // Page is already loaded
-            cout << " -> Page already in memory (Frame " << row.page_frame_no << ")\n";
-            row.referenced = true;
-            row.last_used = time(0);
+// Whether a job may take a slice: yes unless load control suspended it, in which case it is
+// resumed once its resident set fits again, or regardless when force is set
+bool JobScheduler::runnable(int job_no, MemoryMapTable& memoryMapTable, ReplacementState& replacement, bool force) {
+    LocalAllocationState& local = replacement.local;
+    if (local.jobs.empty() || !local.jobs[job_no].suspended) return true;
+    lock_guard<mutex> guard(replacement.lock);
+    if (!force && memoryMapTable.free_frames < local.jobs[job_no].demand) return false;
+    resumeJob(job_no, replacement);
+    return true;
+}
 
-            // update frame's last_used
-            if (row.page_frame_no < (int)pageFrames.size()) {
-                pageFrames[row.page_frame_no].last_used = time(0);
+int JobScheduler::next(MemoryMapTable& memoryMapTable, ReplacementState& replacement, uint64_t& references) {
+    unique_lock<mutex> guard(lock);
+    while (finished < (int)jobs.size()) {
+        if (in_flight < max_in_flight && !ready.empty()) {
+            // Lowest pass first, equal passes in seeded order. A suspended job is forced back
+            // in only when nothing else can run and no slice in flight could free memory for it.
+            auto pick = ready.begin();
+            while (pick != ready.end() && !runnable(get<2>(*pick), memoryMapTable, replacement, false)) ++pick;
+            if (pick == ready.end() && in_flight == 0 && runnable(get<2>(*ready.begin()), memoryMapTable, replacement, true)) pick = ready.begin();
+            if (pick != ready.end()) {
+                int job_no = get<2>(*pick);
+                Entry& entry = entries[job_no];
+                ready.erase(pick);
+                current_pass = entry.pass;
+                references = min(settings.quantum, entry.remaining);
+                entry.slices++;
+                total_slices++;
+                in_flight++;
+                return job_no;
             }
-        } else {
-            cout << " -> Page Fault occurred!\n";
+        }
 
-            // Find free frame
-            int free_frame_no = -1;
-            for (auto& frame : pageFrames) {
-                if (!frame.is_occupied) {
-                    free_frame_no = frame.page_frame_no;
-                    break;
-                }
-            }
+        // Nothing to run until a slice finishes. A waiting worker frees no memory, so a
+        // suspended job must not wait on it.
+        uint64_t seen = generation;
+        guard.unlock();
+        localWorkerIdle(replacement, true);
+        guard.lock();
+        changed.wait(guard, [&] { return generation != seen; });
+        guard.unlock();
+        localWorkerIdle(replacement, false);
+        guard.lock();
+    }
+    return -1;
+}
 
-            // If no free frame, perform replacement
-            if (free_frame_no == -1) {
-                free_frame_no = findFrameToReplace(pageFrames, algorithm);
-                cout << " -> Replacing Frame " << free_frame_no << " using " << algorithm << endl;
-
-                // If old frame had a page, mark that page as not in memory (update PMT)
-                int oldJob = pageFrames[free_frame_no].job_no;
-                int oldPage = pageFrames[free_frame_no].page_no;
-                if (oldPage != -1) {
-                    // find the old job's PMT and clear the entry
-                    for (auto& jt : jobTable) {
-                        if (jt.job_no == oldJob) {
-                            vector<PageMapTableEntry>& oldPMT = pageMapTables[jt.PMT_ID];
-                            for (auto& entry : oldPMT) {
-                                if (entry.page_no == oldPage) {
-                                    entry.status = false;
-                                    entry.page_frame_no = -1;
-                                    entry.last_used = 0;
-                                    entry.time_loaded = 0;
-                                    break;
-                                }
-                            }
-                            break;
-                        }
-                    }
-                }
-            }
+void JobScheduler::finish(int job_no, uint64_t references) {
+    lock_guard<mutex> guard(lock);
+    Entry& entry = entries[job_no];
+    in_flight--;
+    entry.remaining -= references;
+    references_run += references;
+    if (entry.remaining == 0) {
+        entry.finished_at = SIM->access_clock;
+        active--;
+        finished++;
+        admit();
+    } else {
+        entry.pass += entry.stride;
+        ready.insert(make_tuple(entry.pass, tie_break[job_no], job_no));
+    }
+    generation++;
+    changed.notify_all();
+}
 
-            // Load page into the frame
-            pageFrames[free_frame_no].is_occupied = true;
-            pageFrames[free_frame_no].job_no = job.number;
-            pageFrames[free_frame_no].page_no = requestedPage.page_no;
-            pageFrames[free_frame_no].time_loaded = time(0);
-            pageFrames[free_frame_no].last_used = time(0);
+// Print the slices every job got and when it was admitted and finished, in references
+void JobScheduler::printStats() const {
+    const int MAX_JOBS_LISTED = 16;
+    cout << "Scheduler: " << total_slices << " slices of up to " << settings.quantum << " references on " << num_workers
+         << (num_workers == 1 ? " worker" : " workers") << ", " << (settings.max_active > 0 ? to_string(settings.max_active) : string("all"))
+         << " jobs active at once";
+    if (max_in_flight == 1) cout << ", one slice at a time";
+    else if (max_in_flight < num_workers) cout << ", " << max_in_flight << " slices at a time";
+    cout << "\n";
+    for (int i = 0; i < (int)jobs.size() && i < MAX_JOBS_LISTED; ++i) {
+        const Entry& entry = entries[i];
+        cout << "  Job " << jobs[i].number + 1 << ": priority " << entry.priority << ", " << entry.slices << " slices, admitted at "
+             << entry.admitted_at << ", finished at " << entry.finished_at << "\n";
+    }
+    if ((int)jobs.size() > MAX_JOBS_LISTED) cout << "  ... " << jobs.size() - MAX_JOBS_LISTED << " more jobs\n";
+}
 
-            // Update PMT
-            row.status = true;
-            row.page_frame_no = free_frame_no;
-            row.time_loaded = time(0);
-            row.last_used = time(0);
-        }
+// Reference one page of a job, loading it into a frame on a page fault.
+// Shared by the interactive simulation and trace replay; returns true if the reference faulted.
+// The page is translated through the TLB first and the PMT only on a TLB miss; the frame it
+// resolved to is stored in resolved_frame when given.
+//
+// Jobs reference pages concurrently. A hit reads the PMT entry and sets its bits with atomics
+// only, plus replacement.lock for policies that reorder lists on hits. A fault takes
+// replacement.lock twice, each time for O(1) bookkeeping: once to claim a frame and unmap its
+// old page, once to register the new page with the policy. In between only the frame lock
+// (FrameTable::busy) is held, which keeps the frame out of reach of other faults while it loads.
+bool referencePage(Job& job, int page_index, bool is_write, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementState& replacement, int* resolved_frame) {
+    ReferenceTimer timer(SIM->metrics);
+    int page_no = jobTable[job.number].first_page_no + page_index;
+    PagingCounters& counters = jobTable[job.number].counters;
+    uint64_t now = ++SIM->access_clock;
+    counters.clock_ns.fetch_add(SIM->reference_ns, memory_order_relaxed);
+    if (SIM->metrics.enabled() && SIM->metrics.sampleDue(now)) SIM->metrics.sampleResident(now);
+    HugeRegion* region = nullptr;
+    if (replacement.huge.active) {
+        if (now % HUGE_SCAN_INTERVAL == 0) scanHugeRegions(pageFrames, jobTable, pageMapTables, replacement);
+        region = hugeRegionOf(replacement, job.number, page_index);
+    }
+    uint64_t referenced = PageMapTableEntry::REFERENCED | (is_write ? PageMapTableEntry::MODIFIED : 0) | (region ? PageMapTableEntry::ACCESSED : 0);
 
-        // Perform address resolution using the frame that now contains the page
-        int logical_address = rand() % job.size;
-        if (row.page_frame_no >= 0)
-            addressResolution(logical_address, PAGE_SIZE, row.page_frame_no);
-        else
-            addressResolution(logical_address, PAGE_SIZE, -1);
+    // Under local allocation frames age in the job's own virtual time
+    bool local = replacement.local.mode != FrameAllocation::GLOBAL;
+    uint64_t use_time = now;
+    if (local) {
+        JobResidentSet& residentSet = replacement.local.jobs[job.number];
+        if (residentSet.suspended) waitUntilResumed(job.number, memoryMapTable, replacement);
+        use_time = ++residentSet.virtual_time;
+    }
 
-        // Print memory state for clarity
-        printMemoryState(pageFrames);
+    // Translate through the TLB. On a miss walk the page table to the PMT entry and cache it.
+    // A page of a huge region is looked up by its region's tag, and the frame is the region's
+    // run plus the page's offset. The entry may be stale after a demotion, so the PMT confirms it.
+    int frame_no;
+    PageMapTableEntry* pte;
+    bool resident;
+    bool huge = region && region->huge.load(memory_order_relaxed);
+    int region_page = page_index & ~(replacement.huge.pages - 1);
+    if (huge) {
+        resident = SIM->tlb.lookup(job.number, hugeTlbTag(page_index >> replacement.huge.shift), frame_no, pte);
+        if (resident) {
+            frame_no += page_index - region_page;
+            pte = pageMapTables[jobTable[job.number].PMT_ID].find(page_index);
+            uint64_t bits = pte ? pte->word.load() : 0;
+            resident = (bits & PageMapTableEntry::PRESENT) && PageMapTableEntry::frameOf(bits) == frame_no;
+            if (resident) replacement.huge.tlb_hits.fetch_add(1, memory_order_relaxed);
+        }
+    } else {
+        resident = SIM->tlb.lookup(job.number, page_index, frame_no, pte);
     }
-}
+    if (!resident) {
+        pte = &getPageMapTableEntryByPageNumber(page_no, jobTable[job.number], pageMapTables);
+        uint64_t bits = pte->word;
+        frame_no = PageMapTableEntry::frameOf(bits);
+        resident = (bits & PageMapTableEntry::PRESENT) != 0;
+        if (resident && huge) SIM->tlb.insert(job.number, hugeTlbTag(page_index >> replacement.huge.shift), pageMapTables[jobTable[job.number].PMT_ID].entry(region_page));
+        else if (resident) SIM->tlb.insert(job.number, page_index, *pte);
+    }
+    PageMapTableEntry& row = *pte;
+    if (resident) {
+        // Page is already loaded
+        if (resolved_frame) *resolved_frame = frame_no;
+        if (SIM->event_log.logs(LogLevel::ALL)) SIM->event_log.emit(LogEventType::HIT, now, job.number, page_no, frame_no);
+        uint64_t before = row.set(referenced);
+        replacement.hits++;
+        counters.hits.fetch_add(1, memory_order_relaxed);
+        if (region) hugeReferenced(replacement, counters, region, row, before, frame_no);
+        // The first reference to a prefetched page proves the prefetch right and may read further ahead
+        if ((before & PageMapTableEntry::PREFETCHED) && (row.clear(PageMapTableEntry::PREFETCHED) & PageMapTableEntry::PREFETCHED)) {
+            counters.prefetch_hits.fetch_add(1, memory_order_relaxed);
+            SIM->swap.waitReady(counters, frame_no);
+            readAhead(job, page_index, true, pageFrames, memoryMapTable, jobTable, pageMapTables, replacement);
+        }
 
-// FIFO or LRU to find frame to replace
-int findFrameToReplace(vector<PageFrame>& pageFrames, const string& algorithm) {
-    // if some frames are free, return the first free as a fallback
-    for (int i = 0; i < (int)pageFrames.size(); ++i) {
-        if (!pageFrames[i].is_occupied) return i;
+        // update frame's last_used and its place in the replacement queue
+        pageFrames.last_used[frame_no] = use_time;
+        if (!local && tracksHits(replacement.algorithm)) {
+            lock_guard<mutex> lock(replacement.lock);
+            // The page may have been evicted since we looked; then it is no longer ours to promote
+            if (!pageFrames.busy[frame_no] && pageFrames.page_no[frame_no] == page_no) {
+                onFrameReferenced(pageFrames, replacement, frame_no);
+            }
+        }
+        return false;
     }
 
-    if (algorithm == "FIFO") {
-        // choose the frame with the earliest time_loaded (oldest)
-        time_t oldest = pageFrames[0].time_loaded;
-        int victim = 0;
-        for (int i = 1; i < (int)pageFrames.size(); ++i) {
-            if (pageFrames[i].time_loaded < oldest) {
-                oldest = pageFrames[i].time_loaded;
-                victim = i;
+    PageFault fault;
+    fault.page_no = page_no;
+    int free_frame_no = -1;
+    bool dirty_victim = false;
+    uint64_t fault_started = counters.clock_ns;
+    {
+        unique_lock<mutex> lock(replacement.lock);
+        // Another thread may be loading this same page; wait for it and count a hit
+        if (row.word & (PageMapTableEntry::PRESENT | PageMapTableEntry::LOADING)) {
+            lock.unlock();
+            while (row.loading()) this_thread::yield();
+            if (resolved_frame) *resolved_frame = row.frameNo();
+            uint64_t before = row.set(referenced);
+            replacement.hits++;
+            counters.hits.fetch_add(1, memory_order_relaxed);
+            if (region) hugeReferenced(replacement, counters, region, row, before, row.frameNo());
+            if ((before & PageMapTableEntry::PREFETCHED) && (row.clear(PageMapTableEntry::PREFETCHED) & PageMapTableEntry::PREFETCHED)) {
+                counters.prefetch_hits.fetch_add(1, memory_order_relaxed);
+                SIM->swap.waitReady(counters, row.frameNo());
+                readAhead(job, page_index, true, pageFrames, memoryMapTable, jobTable, pageMapTables, replacement);
             }
+            return false;
         }
-        return victim;
-    } else {
-        // LRU: choose the frame with the earliest last_used
-        time_t oldest = pageFrames[0].last_used;
-        int victim = 0;
-        for (int i = 1; i < (int)pageFrames.size(); ++i) {
-            if (pageFrames[i].last_used < oldest) {
-                oldest = pageFrames[i].last_used;
-                victim = i;
+        row.set(PageMapTableEntry::LOADING);
+        if (!replacement.prefetch.displaced.empty() && replacement.prefetch.displaced.erase(page_no)) {
+            counters.pollution_faults.fetch_add(1, memory_order_relaxed);
+        }
+
+        if (SIM->event_log.logs(LogLevel::FAULTS)) SIM->event_log.emit(LogEventType::FAULT, now, job.number, page_no, -1);
+        if (local) {
+            replacement.misses++;
+            // Every frame may be loading; give the loaders a chance to finish
+            while ((free_frame_no = localClaimFrame(job.number, pageFrames, memoryMapTable, jobTable, replacement, dirty_victim)) == -1) {
+                lock.unlock();
+                this_thread::yield();
+                lock.lock();
+            }
+        } else {
+            onPageFault(replacement, fault);
+            while (true) {
+                // Find free frame
+                free_frame_no = replacement.huge.active ? hugeClaimFrame(job.number, page_index, pageFrames, memoryMapTable, replacement) : memoryMapTable.claimFreeFrame();
+                if (free_frame_no != -1) break;
+
+                // If no free frame, perform replacement
+                free_frame_no = findFrameToReplace(pageFrames, replacement, fault);
+                if (free_frame_no != -1) {
+                    if (replacement.huge.active) hugeFrameTaken(free_frame_no, pageFrames, jobTable, memoryMapTable, replacement);
+                    dirty_victim = unmapFrame(pageFrames, jobTable, free_frame_no, job.number, now);
+                    break;
+                }
+
+                // Every frame is loading; give the loaders a chance to finish
+                lock.unlock();
+                this_thread::yield();
+                lock.lock();
             }
         }
-        return victim;
+
+        // Hand the frame to the new page while still under the lock
+        if (region) region->resident++;
+        pageFrames.busy[free_frame_no] = true;
+        pageFrames.job_no[free_frame_no] = job.number;
+        pageFrames.page_no[free_frame_no] = page_no;
+        pageFrames.owner[free_frame_no] = &row;
     }
-}
 
-// Address resolution from logical to physical
-void addressResolution(int logical_addr, int page_size, int frame_no) {
-    if (frame_no < 0) {
-        cout << " -> Address resolution failed: page not in memory\n";
-        return;
+    // Load page into the frame
+    pageFrames.last_used[free_frame_no] = use_time;
+    counters.faults.fetch_add(1, memory_order_relaxed);
+    counters.resident.fetch_add(1, memory_order_relaxed);
+    SIM->swap.pageIn(counters, page_no);
+    if (SIM->mmap_engine.active()) SIM->mmap_engine.load(page_no, free_frame_no);
+    if (SIM->metrics.enabled()) SIM->metrics.recordFaultService(counters.clock_ns - fault_started);
+
+    // Update PMT: frame number and present bit become visible together
+    row.map(free_frame_no, is_write);
+    if (region) hugeReferenced(replacement, counters, region, row, row.set(PageMapTableEntry::ACCESSED), free_frame_no);
+    if (SIM->event_log.logs(LogLevel::FAULTS)) SIM->event_log.emit(LogEventType::LOAD, now, job.number, page_no, free_frame_no);
+    SIM->tlb.insert(job.number, page_index, row);
+    if (resolved_frame) *resolved_frame = free_frame_no;
+
+    {
+        lock_guard<mutex> lock(replacement.lock);
+        if (local) frameListPushBack(replacement.local.jobs[job.number].frames, pageFrames, free_frame_no);
+        else onFrameLoaded(pageFrames, replacement, free_frame_no, fault);
+        pageFrames.busy[free_frame_no] = false;
+        row.clear(PageMapTableEntry::LOADING);
     }
-    int page_no = logical_addr / page_size;
-    int offset = logical_addr % page_size;
-    int physical_addr = frame_no * page_size + offset;
-    cout << " -> Logical Address " << logical_addr << " => Page " << page_no << ", Offset " << offset
-         << " => Physical Address " << physical_addr << endl;
+    readAhead(job, page_index, false, pageFrames, memoryMapTable, jobTable, pageMapTables, replacement);
+    return true;
 }
 
-// Print a snapshot of memory frames
-void printMemoryState(const vector<PageFrame>& pageFrames) {
-    cout << " Memory frames snapshot:\n";
-    for (const auto& f : pageFrames) {
-        if (f.is_occupied) {
-            cout << "  Frame " << f.page_frame_no << ": Job " << f.job_no + 1 << ", Page " << f.page_no << "\n";
-        } else {
-            cout << "  Frame " << f.page_frame_no << ": [Empty]\n";
+// Pick the frame to evict with the configured replacement algorithm once memory is full.
+// Called with replacement.lock held; the victim comes back detached from the policy's lists.
+// Frames claimed by faults still loading are on no list, so this returns -1 when every frame
+// is loading.
+int findFrameToReplace(FrameTable& pageFrames, ReplacementState& replacement, const PageFault& fault) {
+    switch (replacement.algorithm) {
+    case ReplacementAlgorithm::CLOCK:
+        return clockSweep(pageFrames, replacement);
+    case ReplacementAlgorithm::ENHANCED_CLOCK:
+        return enhancedClockSweep(pageFrames, replacement);
+    case ReplacementAlgorithm::ARC:
+        return arcReplace(pageFrames, replacement.arc, fault);
+    case ReplacementAlgorithm::TWO_Q:
+        return twoQReplace(pageFrames, replacement.twoQ);
+    case ReplacementAlgorithm::LIRS:
+        return lirsReplace(replacement.lirs);
+    case ReplacementAlgorithm::OPT:
+        return optReplace(replacement.opt);
+    case ReplacementAlgorithm::SECOND_CHANCE:
+        // Referenced pages at the head lose their bit and go to the back of the queue
+        while (true) {
+            int frame_no = replacement.queue.head;
+            if (frame_no == -1) return -1;
+            PageMapTableEntry* entry = pageFrames.owner[frame_no];
+            frameListRemove(replacement.queue, pageFrames, frame_no);
+            if (entry && entry->referenced()) {
+                entry->clear(PageMapTableEntry::REFERENCED);
+                frameListPushBack(replacement.queue, pageFrames, frame_no);
+                continue;
+            }
+            return frame_no;
         }
+    default:
+        break;
     }
-    cout << endl;
+
+    // The head of the queue is the oldest load (FIFO) or the least recently used frame (LRU).
+    // The caller reloads the frame, which puts it back at the tail.
+    int victim = replacement.queue.head;
+    if (victim != -1) frameListRemove(replacement.queue, pageFrames, victim);
+    return victim;
+}
+
+// If the frame holds a page, mark that page as not in memory (update PMT), drop its
+// translation and count the eviction. A modified page is written back to the swap device on
+// behalf of for_job, the job that needs the frame. Returns whether the page was modified.
+// Called with replacement.lock held and the frame detached from every replacement list.
+bool unmapFrame(FrameTable& pageFrames, vector<JobTableEntry>& jobTable, int frame_no, int for_job, uint64_t now) {
+    PageMapTableEntry* oldEntry = pageFrames.owner[frame_no];
+    if (!oldEntry) return false;
+    // A resident page is never loading, so this clears the whole entry
+    uint64_t old = oldEntry->word.exchange(0);
+    bool dirty = (old & PageMapTableEntry::MODIFIED) != 0;
+    if (SIM->mmap_engine.active()) SIM->mmap_engine.evict(pageFrames.page_no[frame_no], frame_no, dirty);
+    // Only after present is cleared, so a racing TLB fill can't re-cache the mapping
+    int victim_job = pageFrames.job_no[frame_no];
+    PagingCounters& victim_counters = jobTable[victim_job].counters;
+    victim_counters.evictions.fetch_add(1, memory_order_relaxed);
+    if (old & PageMapTableEntry::PREFETCHED) victim_counters.prefetch_wasted.fetch_add(1, memory_order_relaxed);
+    if (dirty) {
+        victim_counters.dirty_evictions.fetch_add(1, memory_order_relaxed);
+        SIM->swap.writeBack(jobTable[for_job].counters, pageFrames.page_no[frame_no]);
+    }
+    victim_counters.resident.fetch_sub(1, memory_order_relaxed);
+    SIM->tlb.invalidate(victim_job, pageFrames.page_no[frame_no] - jobTable[victim_job].first_page_no);
+    if (SIM->event_log.logs(LogLevel::FAULTS)) SIM->event_log.emit(LogEventType::EVICT, now, victim_job, pageFrames.page_no[frame_no], frame_no);
+    return dirty;
+}
+
+// Local allocation: take a frame out of a job's resident set and give it back to memory
+void releaseFrame(FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, ReplacementState& replacement, int job_no, int frame_no) {
+    frameListRemove(replacement.local.jobs[job_no].frames, pageFrames, frame_no);
+    unmapFrame(pageFrames, jobTable, frame_no, job_no, SIM->access_clock);
+    pageFrames.owner[frame_no] = nullptr;
+    pageFrames.job_no[frame_no] = -1;
+    pageFrames.page_no[frame_no] = -1;
+    memoryMapTable.release(frame_no);
+    replacement.local.released++;
+}
+
+// Second chance within one resident set; the set must not be empty
+int localSecondChance(FrameTable& pageFrames, FrameList& frames) {
+    while (true) {
+        int frame_no = frames.head;
+        frameListRemove(frames, pageFrames, frame_no);
+        PageMapTableEntry* entry = pageFrames.owner[frame_no];
+        if (entry && entry->referenced()) {
+            entry->clear(PageMapTableEntry::REFERENCED);
+            frameListPushBack(frames, pageFrames, frame_no);
+            continue;
+        }
+        return frame_no;
+    }
+}
+
+// Suspend a job for load control: release its resident set and remember how big it was
+void suspendJob(int job_no, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, ReplacementState& replacement) {
+    JobResidentSet& residentSet = replacement.local.jobs[job_no];
+    residentSet.demand = residentSet.frames.size;
+    residentSet.suspended = true;
+    replacement.local.suspensions++;
+    while (residentSet.frames.size > 0) releaseFrame(pageFrames, memoryMapTable, jobTable, replacement, job_no, residentSet.frames.head);
+    if (SIM->event_log.logs(LogLevel::FAULTS)) SIM->event_log.emit(LogEventType::SUSPEND, SIM->access_clock, job_no, -1, -1, residentSet.demand);
+}
+
+// Local allocation: size the faulting job's resident set and find it a frame. Called with
+// replacement.lock held; returns -1 if every frame is still loading. The frame comes back
+// unmapped and off every list, and dirty_victim tells whether its old page needs writing back.
+int localClaimFrame(int job_no, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, ReplacementState& replacement, bool& dirty_victim) {
+    LocalAllocationState& local = replacement.local;
+    JobResidentSet& residentSet = local.jobs[job_no];
+    uint64_t now = residentSet.virtual_time;
+    bool grow = true;
+
+    if (local.mode == FrameAllocation::WORKING_SET) {
+        // Trim pages that left the window, every eighth of a window
+        if (now - residentSet.last_trim >= max<uint64_t>(1, SIM->ws_window / 8)) {
+            residentSet.last_trim = now;
+            for (int frame_no = residentSet.frames.head; frame_no != -1;) {
+                int next = pageFrames.next[frame_no];
+                if (now - pageFrames.last_used[frame_no] > SIM->ws_window) releaseFrame(pageFrames, memoryMapTable, jobTable, replacement, job_no, frame_no);
+                frame_no = next;
+            }
+            local.resumed.notify_all();
+        }
+    } else {
+        // Page fault frequency: a long gap since the last fault means the set is too big
+        grow = now - residentSet.last_fault <= SIM->pff_interval;
+        residentSet.last_fault = now;
+        if (!grow) {
+            for (int frame_no = residentSet.frames.head; frame_no != -1;) {
+                int next = pageFrames.next[frame_no];
+                PageMapTableEntry* entry = pageFrames.owner[frame_no];
+                if (!entry->referenced()) releaseFrame(pageFrames, memoryMapTable, jobTable, replacement, job_no, frame_no);
+                else entry->clear(PageMapTableEntry::REFERENCED);
+                frame_no = next;
+            }
+            local.resumed.notify_all();
+        }
+    }
+
+    int frame_no = memoryMapTable.claimFreeFrame();
+    if (frame_no != -1) return frame_no;
+
+    // Memory is full. A job that has to grow overcommits it: suspend a job of lower priority.
+    if (grow && local.load_control) {
+        for (int r = (int)local.priority_order.size() - 1; r > local.rank[job_no]; --r) {
+            int victim_job = local.priority_order[r];
+            if (local.jobs[victim_job].suspended || local.jobs[victim_job].frames.size == 0) continue;
+            suspendJob(victim_job, pageFrames, memoryMapTable, jobTable, replacement);
+            frame_no = memoryMapTable.claimFreeFrame();
+            if (frame_no != -1) return frame_no;
+        }
+    }
+
+    // Otherwise replace within the job's own set. A job without frames takes one from the
+    // biggest set, which also reaches frames that suspended jobs finished loading.
+    FrameList* frames = &residentSet.frames;
+    if (frames->size == 0) {
+        for (auto& other : local.jobs) {
+            if (other.frames.size > frames->size) frames = &other.frames;
+        }
+        if (frames->size == 0) return -1;
+    }
+    frame_no = localSecondChance(pageFrames, *frames);
+    dirty_victim = unmapFrame(pageFrames, jobTable, frame_no, job_no, SIM->access_clock);
+    return frame_no;
+}
+
+// Block a reference of a suspended job until its resident set fits into free memory again,
+// or until no worker is left running to free any
+void waitUntilResumed(int job_no, MemoryMapTable& memoryMapTable, ReplacementState& replacement) {
+    LocalAllocationState& local = replacement.local;
+    JobResidentSet& residentSet = local.jobs[job_no];
+    unique_lock<mutex> lock(replacement.lock);
+    local.waiting_threads++;
+    while (residentSet.suspended) {
+        if (memoryMapTable.free_frames >= residentSet.demand || local.waiting_threads >= local.running_threads) {
+            resumeJob(job_no, replacement);
+            break;
+        }
+        local.resumed.wait_for(lock, chrono::milliseconds(10));
+    }
+    local.waiting_threads--;
+}
+
+// Let a suspended job run again. Called with replacement.lock held.
+void resumeJob(int job_no, ReplacementState& replacement) {
+    JobResidentSet& residentSet = replacement.local.jobs[job_no];
+    residentSet.suspended = false;
+    replacement.local.resumptions++;
+    if (SIM->event_log.logs(LogLevel::FAULTS)) SIM->event_log.emit(LogEventType::RESUME, SIM->access_clock, job_no, -1, -1, residentSet.demand);
+}
+
+// A worker went idle waiting for a slice, or got one again. Idle workers free no memory, so
+// they do not count as running for jobs waiting to be resumed.
+void localWorkerIdle(ReplacementState& replacement, bool idle) {
+    if (replacement.local.mode == FrameAllocation::GLOBAL) return;
+    lock_guard<mutex> lock(replacement.lock);
+    replacement.local.running_threads += idle ? -1 : 1;
+    replacement.local.resumed.notify_all();
+}
+
+// A worker thread is done; waiting jobs may no longer be able to count on it
+void localThreadFinished(ReplacementState& replacement) {
+    if (replacement.local.mode == FrameAllocation::GLOBAL) return;
+    lock_guard<mutex> lock(replacement.lock);
+    replacement.local.running_threads--;
+    replacement.local.resumed.notify_all();
+}
+
+// Read ahead after a demand fault, or after the first reference to a prefetched page
+// (on_hit), if the job's detector sees a stream. Takes replacement.lock.
+void readAhead(Job& job, int page_index, bool on_hit, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementState& replacement) {
+    if (replacement.prefetch.jobs.empty()) return;
+    lock_guard<mutex> lock(replacement.lock);
+    StreamDetector& stream = replacement.prefetch.jobs[job.number];
+    int first;
+    if (on_hit) {
+        // Only the first page of the last read-ahead triggers the next one
+        if (page_index != stream.trigger) return;
+        first = stream.next;
+    } else {
+        int stride = page_index - stream.last_page;
+        if (stream.last_page < 0 || stride != stream.stride) {
+            // Not (yet) a stream: remember the stride and wait for a fault that repeats it
+            stream.stride = stream.last_page < 0 ? 0 : stride;
+            stream.last_page = page_index;
+            stream.window = 0;
+            stream.trigger = -1;
+            return;
+        }
+        first = page_index + stride;
+    }
+    stream.last_page = page_index;
+    if (stream.stride == 0 || abs(stream.stride) > SIM->prefetch_max_stride) return;
+
+    stream.window = stream.window == 0 ? min(SIM->prefetch_window, 4) : min(SIM->prefetch_window, 2 * stream.window);
+    stream.trigger = first;
+    stream.next = first + stream.window * stream.stride;
+    for (int i = 0; i < stream.window; ++i) {
+        int page = first + i * stream.stride;
+        if (page < 0 || page >= job.num_pages) break;
+        prefetchPage(job, page, pageFrames, memoryMapTable, jobTable, pageMapTables, replacement);
+    }
+}
+
+// Load one page ahead of use, unless it is already resident or loading. A free frame is taken
+// if there is one; otherwise the global policy's next victim, which under local allocation is
+// not allowed (a prefetch must not cost another job or the job itself a page it uses).
+// Called with replacement.lock held, for the whole load, so no frame lock is needed.
+bool prefetchPage(Job& job, int page_index, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementState& replacement) {
+    int page_no = jobTable[job.number].first_page_no + page_index;
+    PageMapTableEntry& row = getPageMapTableEntryByPageNumber(page_no, jobTable[job.number], pageMapTables);
+    if (row.word & (PageMapTableEntry::PRESENT | PageMapTableEntry::LOADING)) return false;
+
+    bool local = replacement.local.mode != FrameAllocation::GLOBAL;
+    PageFault fault;
+    fault.page_no = page_no;
+    if (!local) {
+        onPageFault(replacement, fault);
+        replacement.misses--;  // a prefetch is not a reference
+    }
+    int frame_no = replacement.huge.active ? hugeClaimFrame(job.number, page_index, pageFrames, memoryMapTable, replacement) : memoryMapTable.claimFreeFrame();
+    if (frame_no == -1) {
+        if (local) return false;
+        frame_no = findFrameToReplace(pageFrames, replacement, fault);
+        if (frame_no == -1) return false;
+        if (pageFrames.owner[frame_no]) replacement.prefetch.displaced.insert(pageFrames.page_no[frame_no]);
+        if (replacement.huge.active) hugeFrameTaken(frame_no, pageFrames, jobTable, memoryMapTable, replacement);
+        unmapFrame(pageFrames, jobTable, frame_no, job.number, SIM->access_clock);
+    }
+    if (replacement.huge.active) {
+        HugeRegion* region = hugeRegionOf(replacement, job.number, page_index);
+        if (region) region->resident++;
+    }
+
+    pageFrames.job_no[frame_no] = job.number;
+    pageFrames.page_no[frame_no] = page_no;
+    pageFrames.owner[frame_no] = &row;
+    pageFrames.last_used[frame_no] = local ? replacement.local.jobs[job.number].virtual_time.load() : SIM->access_clock.load();
+    row.mapPrefetched(frame_no);
+    PagingCounters& counters = jobTable[job.number].counters;
+    counters.prefetches.fetch_add(1, memory_order_relaxed);
+    counters.resident.fetch_add(1, memory_order_relaxed);
+    SIM->swap.prefetchIn(counters, page_no, frame_no);
+    if (SIM->mmap_engine.active()) SIM->mmap_engine.load(page_no, frame_no);
+    if (local) frameListPushBack(replacement.local.jobs[job.number].frames, pageFrames, frame_no);
+    else onFrameLoaded(pageFrames, replacement, frame_no, fault);
+    if (SIM->event_log.logs(LogLevel::FAULTS)) SIM->event_log.emit(LogEventType::PREFETCH, SIM->access_clock, job.number, page_no, frame_no);
+    return true;
+}
+
+// TLB tag of a huge region: negative, so it never collides with a base page's number
+int hugeTlbTag(int region) {
+    return -2 - region;
+}
+
+// The region a page belongs to, or nullptr for the partial region at the end of a job
+HugeRegion* hugeRegionOf(ReplacementState& replacement, int job_no, int page_index) {
+    vector<HugeRegion>& regions = replacement.huge.jobs[job_no];
+    int region = page_index >> replacement.huge.shift;
+    return region < (int)regions.size() ? &regions[region] : nullptr;
+}
+
+// A reference set the page's bits, which were before. Counts the first reference since the
+// last scan towards the region's density, and the first reference to a filled page.
+void hugeReferenced(ReplacementState& replacement, PagingCounters& counters, HugeRegion* region, PageMapTableEntry& row, uint64_t before, int frame_no) {
+    if (!(before & PageMapTableEntry::ACCESSED) && region->run.load(memory_order_relaxed) >= 0) region->touched.fetch_add(1, memory_order_relaxed);
+    if ((before & PageMapTableEntry::FILLED) && (row.clear(PageMapTableEntry::FILLED) & PageMapTableEntry::FILLED)) {
+        replacement.huge.fill_hits.fetch_add(1, memory_order_relaxed);
+        SIM->swap.waitReady(counters, frame_no);
+    }
+}
+
+// Find a frame for a page when huge pages are on: its slot if its region has a reservation, a
+// new reservation if the region has nothing in memory, else any free frame. With no free frame
+// left, the reservation with the fewest pages in memory gives up its idle frames.
+// Returns -1 when every frame holds a page. The caller counts the page into its region once it
+// has a frame, free or evicted. Called with replacement.lock held.
+int hugeClaimFrame(int job_no, int page_index, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, ReplacementState& replacement) {
+    HugePageState& huge = replacement.huge;
+    HugeRegion* region = hugeRegionOf(replacement, job_no, page_index);
+    int slot = page_index & (huge.pages - 1);
+    if (region && region->run >= 0) {
+        // A reservation is broken before any of its frames is taken, so the slot is idle
+        huge.idle_frames--;
+        return region->run + slot;
+    }
+    if (region && region->resident == 0) {
+        int run = memoryMapTable.claimRun(huge.pages);
+        if (run >= 0) {
+            huge.reservation_of[run >> huge.shift] = (int)huge.reservations.size();
+            huge.reservations.push_back({job_no, page_index >> huge.shift});
+            huge.idle_frames += huge.pages - 1;
+            huge.reserved++;
+            region->run = run;
+            return run + slot;
+        }
+    }
+    int frame_no;
+    while ((frame_no = memoryMapTable.claimFreeFrame()) == -1 && huge.idle_frames > 0) {
+        int fewest = -1, fewest_resident = huge.pages;
+        for (int i = 0; i < (int)huge.reservations.size(); ++i) {
+            const pair<int, int>& reservation = huge.reservations[i];
+            int in_memory = huge.jobs[reservation.first][reservation.second].resident;
+            if (in_memory < fewest_resident) {
+                fewest = i;
+                fewest_resident = in_memory;
+            }
+        }
+        breakReservation(fewest, memoryMapTable, replacement, pageFrames);
+    }
+    return frame_no;
+}
+
+// The policy chose frame_no as a victim: its page leaves its region, and a reservation the
+// frame belongs to is broken since the frame goes to another page. Called with
+// replacement.lock held, before the page is unmapped.
+void hugeFrameTaken(int frame_no, FrameTable& pageFrames, vector<JobTableEntry>& jobTable, MemoryMapTable& memoryMapTable, ReplacementState& replacement) {
+    HugePageState& huge = replacement.huge;
+    PageMapTableEntry* entry = pageFrames.owner[frame_no];
+    if (!entry) return;
+    int job_no = pageFrames.job_no[frame_no];
+    HugeRegion* region = hugeRegionOf(replacement, job_no, pageFrames.page_no[frame_no] - jobTable[job_no].first_page_no);
+    if (!region) return;
+    region->resident--;
+    if (entry->word & PageMapTableEntry::FILLED) huge.fill_wasted.fetch_add(1, memory_order_relaxed);
+    int run = region->run;
+    if (run >= 0) breakReservation(huge.reservation_of[run >> huge.shift], memoryMapTable, replacement, pageFrames);
+}
+
+// Give up a reservation: demote the region if it is huge and free the frames of the run that
+// hold no page. Pages in the run stay where they are, as base pages; a frame the policy just
+// took still has its old owner, so it is not mistaken for an idle one.
+void breakReservation(int index, MemoryMapTable& memoryMapTable, ReplacementState& replacement, FrameTable& pageFrames) {
+    HugePageState& huge = replacement.huge;
+    pair<int, int> reservation = huge.reservations[index];
+    HugeRegion& region = huge.jobs[reservation.first][reservation.second];
+    if (region.huge) demoteRegion(reservation.first, reservation.second, replacement);
+    int run = region.run;
+    for (int frame_no = run; frame_no < run + huge.pages; ++frame_no) {
+        if (pageFrames.owner[frame_no]) continue;
+        memoryMapTable.release(frame_no);
+        huge.idle_frames--;
+    }
+    region.run = -1;
+    region.touched = 0;
+    huge.reservation_of[run >> huge.shift] = -1;
+    // Keep the list dense: move the last reservation into the hole
+    huge.reservations[index] = huge.reservations.back();
+    huge.reservations.pop_back();
+    if (index < (int)huge.reservations.size()) {
+        const pair<int, int>& moved = huge.reservations[index];
+        huge.reservation_of[huge.jobs[moved.first][moved.second].run >> huge.shift] = index;
+    }
+    huge.broken++;
+}
+
+// Split a huge page back into base pages: drop its TLB entry, so its pages are looked up one by one
+void demoteRegion(int job_no, int region, ReplacementState& replacement) {
+    replacement.huge.jobs[job_no][region].huge = false;
+    SIM->tlb.invalidate(job_no, hugeTlbTag(region));
+    replacement.huge.demotions++;
+}
+
+// Promote a reserved region to a huge page: load every page of it not in memory into its slot,
+// as one read per page that counts as neither fault nor prefetch, and let one TLB entry map the
+// run. Gives up if a page of the region is being loaded. Called with replacement.lock held.
+bool promoteRegion(int job_no, int region, FrameTable& pageFrames, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementState& replacement) {
+    HugePageState& huge = replacement.huge;
+    HugeRegion& hugeRegion = huge.jobs[job_no][region];
+    PageTable& table = pageMapTables[jobTable[job_no].PMT_ID];
+    int first = region << huge.shift;
+    for (int i = 0; i < huge.pages; ++i) {
+        if (table.entry(first + i).loading()) return false;
+    }
+    PagingCounters& counters = jobTable[job_no].counters;
+    for (int i = 0; i < huge.pages; ++i) {
+        PageMapTableEntry& row = table.entry(first + i);
+        if (row.present()) continue;
+        int page_no = jobTable[job_no].first_page_no + first + i;
+        int frame_no = hugeRegion.run + i;
+        PageFault fault;
+        fault.page_no = page_no;
+        onPageFault(replacement, fault);
+        replacement.misses--;  // a fill is not a reference
+        pageFrames.job_no[frame_no] = job_no;
+        pageFrames.page_no[frame_no] = page_no;
+        pageFrames.owner[frame_no] = &row;
+        pageFrames.last_used[frame_no] = SIM->access_clock.load();
+        row.mapFilled(frame_no);
+        counters.resident.fetch_add(1, memory_order_relaxed);
+        hugeRegion.resident++;
+        huge.idle_frames--;
+        huge.fills.fetch_add(1, memory_order_relaxed);
+        SIM->swap.prefetchIn(counters, page_no, frame_no);
+        if (SIM->mmap_engine.active()) SIM->mmap_engine.load(page_no, frame_no);
+        onFrameLoaded(pageFrames, replacement, frame_no, fault);
+    }
+    for (int i = 0; i < huge.pages; ++i) SIM->tlb.invalidate(job_no, first + i);
+    hugeRegion.huge = true;
+    huge.promotions++;
+    return true;
+}
+
+// Every HUGE_SCAN_INTERVAL references: measure each reserved region's access density since the
+// last scan, promote the dense ones and demote huge pages that went sparse. Takes replacement.lock.
+void scanHugeRegions(FrameTable& pageFrames, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementState& replacement) {
+    lock_guard<mutex> lock(replacement.lock);
+    HugePageState& huge = replacement.huge;
+    // Promotion never adds or removes reservations, so the list can be walked as is
+    for (const pair<int, int>& reservation : huge.reservations) {
+        int job_no = reservation.first, region = reservation.second;
+        HugeRegion& hugeRegion = huge.jobs[job_no][region];
+        PageTable& table = pageMapTables[jobTable[job_no].PMT_ID];
+        // Clear the bits before the count, so a reference in between is missed, not counted twice
+        for (int i = 0; i < huge.pages; ++i) table.entry((region << huge.shift) + i).clear(PageMapTableEntry::ACCESSED);
+        double density = (double)hugeRegion.touched.exchange(0) / huge.pages;
+        if (!hugeRegion.huge && density >= SIM->huge_promote_density) promoteRegion(job_no, region, pageFrames, jobTable, pageMapTables, replacement);
+        else if (hugeRegion.huge && density < SIM->huge_demote_density) demoteRegion(job_no, region, replacement);
+    }
+}
+
+// CLOCK: advance the hand, clearing referenced bits, until it reaches an unreferenced page.
+// Two laps clear every bit, so coming up empty after them means every frame is loading.
+int clockSweep(FrameTable& pageFrames, ReplacementState& replacement) {
+    int num_frames = (int)pageFrames.size();
+    for (int step = 0; step < 2 * num_frames; ++step) {
+        int frame_no = replacement.hand;
+        replacement.hand = (replacement.hand + 1) % num_frames;
+        if (pageFrames.busy[frame_no]) continue;  // claimed by a fault still in progress
+
+        PageMapTableEntry* entry = pageFrames.owner[frame_no];
+        if (entry && entry->referenced()) {
+            entry->clear(PageMapTableEntry::REFERENCED);
+            continue;
+        }
+        return frame_no;
+    }
+    return -1;
+}
+
+// Enhanced CLOCK: the first lap looks for a (0,0) page without touching any bits, the second
+// looks for (0,1) while clearing referenced bits behind the hand. After two laps every bit is
+// clear, so repeating the pair once finds a victim unless every frame is loading (-1), and
+// clean pages win over dirty ones.
+int enhancedClockSweep(FrameTable& pageFrames, ReplacementState& replacement) {
+    int num_frames = (int)pageFrames.size();
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 0; i < num_frames; ++i) {
+            int frame_no = (replacement.hand + i) % num_frames;
+            if (pageFrames.busy[frame_no]) continue;  // claimed by a fault still in progress
+            PageMapTableEntry* entry = pageFrames.owner[frame_no];
+            if (!entry || (entry->word & (PageMapTableEntry::REFERENCED | PageMapTableEntry::MODIFIED)) == 0) {
+                replacement.hand = (frame_no + 1) % num_frames;
+                return frame_no;
+            }
+        }
+        for (int i = 0; i < num_frames; ++i) {
+            int frame_no = (replacement.hand + i) % num_frames;
+            if (pageFrames.busy[frame_no]) continue;
+            PageMapTableEntry* entry = pageFrames.owner[frame_no];
+            if (!entry->referenced()) {
+                replacement.hand = (frame_no + 1) % num_frames;
+                return frame_no;
+            }
+            entry->clear(PageMapTableEntry::REFERENCED);
+        }
+    }
+    return -1;
+}
+
+// Reset replacement bookkeeping for a run over num_frames frames
+void initReplacementState(ReplacementState& replacement, ReplacementAlgorithm algorithm, int num_frames) {
+    replacement.algorithm = algorithm;
+    replacement.queue = FrameList();
+    replacement.hand = 0;
+    replacement.arc = ArcState();
+    replacement.twoQ = TwoQState();
+    replacement.lirs = LirsState();
+    replacement.opt = OptState();
+    replacement.hits = 0;
+    replacement.misses = 0;
+    replacement.arc.capacity = num_frames;
+    // Sizes suggested by the 2Q and LIRS papers: A1in 25% and A1out 50% of memory, and
+    // 1% of memory (at least one frame) kept for resident HIR pages
+    replacement.twoQ.kin = max(1, num_frames / 4);
+    replacement.twoQ.kout = max(1, num_frames / 2);
+    replacement.lirs.lir_capacity = max(1, num_frames - max(1, num_frames / 100));
+    if (algorithm == ReplacementAlgorithm::OPT) replacement.opt.frame_next_use.assign(num_frames, 0);
+}
+
+// Rank jobs for load control, which suspends the lowest first. Without this call jobs rank
+// by job number.
+void setLocalPriorities(ReplacementState& replacement, const vector<int>& priority_order) {
+    LocalAllocationState& local = replacement.local;
+    if (local.jobs.empty()) return;
+    local.priority_order = priority_order;
+    for (int r = 0; r < (int)priority_order.size(); ++r) local.rank[priority_order[r]] = r;
+}
+
+// Set up local allocation from frame_allocation for a run of num_jobs jobs on num_threads
+// worker threads. Replay passes 0: it must run the trace in order and cannot hold a job back,
+// so it runs without load control.
+void initLocalAllocation(ReplacementState& replacement, int num_jobs, int num_threads) {
+    LocalAllocationState& local = replacement.local;
+    local.mode = SIM->frame_allocation;
+    local.load_control = SIM->load_control && num_threads > 0;
+    local.jobs = vector<JobResidentSet>(local.mode == FrameAllocation::GLOBAL ? 0 : num_jobs);
+    local.priority_order.clear();
+    local.rank.clear();
+    for (int i = 0; i < (int)local.jobs.size(); ++i) {
+        local.priority_order.push_back(i);
+        local.rank.push_back(i);
+    }
+    local.running_threads = num_threads;
+    local.waiting_threads = 0;
+    local.released = local.suspensions = local.resumptions = 0;
+}
+
+// Set up read-ahead from prefetch_window for a run of num_jobs jobs. Call after
+// initReplacementState: OPT runs without read-ahead, since it knows the next use of referenced
+// pages only and a prefetched page would enter its heap with the demand page's.
+void initPrefetch(ReplacementState& replacement, int num_jobs) {
+    bool enabled = SIM->prefetch_window > 0 && replacement.algorithm != ReplacementAlgorithm::OPT;
+    replacement.prefetch.jobs = vector<StreamDetector>(enabled ? num_jobs : 0);
+    replacement.prefetch.displaced.clear();
+}
+
+// Set up huge pages from huge_page_pages for a run over num_frames frames. They need global
+// allocation, and OPT, whose victims follow the trace, has no use for promotion's fills.
+void initHugePages(ReplacementState& replacement, const vector<Job>& jobs, int num_frames) {
+    HugePageState& huge = replacement.huge;
+    huge.active = SIM->huge_page_pages > 1 && replacement.local.mode == FrameAllocation::GLOBAL && replacement.algorithm != ReplacementAlgorithm::OPT;
+    huge.pages = huge.active ? SIM->huge_page_pages : 0;
+    huge.shift = huge.active ? highestSetBit(SIM->huge_page_pages) : 0;
+    huge.jobs.clear();
+    huge.reservations.clear();
+    huge.reservation_of.assign(huge.active ? num_frames >> huge.shift : 0, -1);
+    huge.idle_frames = 0;
+    huge.reserved = huge.broken = huge.promotions = huge.demotions = 0;
+    huge.fills = 0;
+    huge.fill_hits = 0;
+    huge.fill_wasted = 0;
+    huge.tlb_hits = 0;
+    if (!huge.active) return;
+    // Only whole regions can become huge pages; the tail of a job stays in base pages
+    huge.jobs.reserve(jobs.size());
+    for (const auto& job : jobs) huge.jobs.emplace_back(job.size == 0 ? 0 : job.num_pages >> huge.shift);
+}
+
+// A referenced page is not resident. Runs before a frame is chosen so that the adaptive
+// policies can consult and trim their ghost lists; what they learn goes into fault.
+void onPageFault(ReplacementState& replacement, PageFault& fault) {
+    int page_no = fault.page_no;
+    replacement.misses++;
+    switch (replacement.algorithm) {
+    case ReplacementAlgorithm::ARC: {
+        ArcState& arc = replacement.arc;
+        int c = arc.capacity;
+        fault.load_into_frequent = true;
+        if (arc.b1.contains(page_no)) {
+            arc.b1_hits++;
+            arc.p = min(c, arc.p + max(arc.b2.size() / arc.b1.size(), 1));
+            arc.b1.remove(page_no);
+        } else if (arc.b2.contains(page_no)) {
+            arc.b2_hits++;
+            fault.in_ghost_b2 = true;
+            arc.p = max(0, arc.p - max(arc.b1.size() / arc.b2.size(), 1));
+            arc.b2.remove(page_no);
+        } else {
+            fault.load_into_frequent = false;
+            int l1 = arc.t1.size + arc.b1.size();
+            int total = l1 + arc.t2.size + arc.b2.size();
+            if (l1 >= c) {
+                // L1 is full: drop its oldest ghost, or the oldest T1 page outright if T1 is all of it
+                if (arc.t1.size < c) arc.b1.popFront();
+                else fault.evict_without_ghost = true;
+            } else if (total >= 2 * c && arc.b2.size() > 0) {
+                arc.b2.popFront();
+            }
+        }
+        break;
+    }
+    case ReplacementAlgorithm::TWO_Q: {
+        TwoQState& twoQ = replacement.twoQ;
+        fault.load_into_frequent = twoQ.a1out.contains(page_no);
+        if (fault.load_into_frequent) {
+            twoQ.a1out_hits++;
+            twoQ.a1out.remove(page_no);
+        }
+        break;
+    }
+    case ReplacementAlgorithm::LIRS: {
+        LirsState& lirs = replacement.lirs;
+        auto it = lirs.pages.find(page_no);
+        if (it != lirs.pages.end() && it->second.in_stack) lirs.ghost_hits++;
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// ARC REPLACE: evict from T1 while it is over its target size p, otherwise from T2,
+// remembering the victim in the matching ghost list
+int arcReplace(FrameTable& pageFrames, ArcState& arc, const PageFault& fault) {
+    if (arc.t1.size == 0 && arc.t2.size == 0) return -1;
+    if (fault.evict_without_ghost && arc.t1.size > 0) {
+        int victim = arc.t1.head;
+        frameListRemove(arc.t1, pageFrames, victim);
+        return victim;
+    }
+    bool fromT1 = arc.t1.size > 0 && (arc.t1.size > arc.p || (fault.in_ghost_b2 && arc.t1.size == arc.p));
+    if (arc.t2.size == 0) fromT1 = true;
+    FrameList& source = fromT1 ? arc.t1 : arc.t2;
+    int victim = source.head;
+    frameListRemove(source, pageFrames, victim);
+    (fromT1 ? arc.b1 : arc.b2).pushBack(pageFrames.page_no[victim]);
+    return victim;
+}
+
+// 2Q reclaim: once A1in exceeds Kin its oldest page is evicted into A1out, otherwise the
+// LRU page of Am goes
+int twoQReplace(FrameTable& pageFrames, TwoQState& twoQ) {
+    if (twoQ.a1in.size == 0 && twoQ.am.size == 0) return -1;
+    if (twoQ.a1in.size > twoQ.kin || twoQ.am.size == 0) {
+        int victim = twoQ.a1in.head;
+        frameListRemove(twoQ.a1in, pageFrames, victim);
+        twoQ.a1out.pushBack(pageFrames.page_no[victim]);
+        if (twoQ.a1out.size() > twoQ.kout) twoQ.a1out.popFront();
+        return victim;
+    }
+    int victim = twoQ.am.head;
+    frameListRemove(twoQ.am, pageFrames, victim);
+    return victim;
+}
+
+// LIRS: evict the resident HIR page at the front of Q. If it is still in the stack it stays
+// there as a non-resident ghost.
+int lirsReplace(LirsState& lirs) {
+    if (lirs.queue.empty()) lirsDemoteBottom(lirs);
+    if (lirs.queue.empty()) return -1;
+
+    int page_no = lirs.queue.front();
+    LirsEntry& entry = lirs.pages[page_no];
+    lirs.queue.pop_front();
+    entry.in_queue = false;
+    entry.resident = false;
+    int victim = entry.frame_no;
+    entry.frame_no = -1;
+
+    if (entry.in_stack) {
+        lirs.non_resident.pushBack(page_no);
+        // Keep at most as many ghosts in S as there are LIR pages
+        if (lirs.non_resident.size() > lirs.lir_capacity) {
+            int oldest = lirs.non_resident.order.front();
+            lirs.non_resident.popFront();
+            lirs.stack.erase(lirs.pages[oldest].stack_pos);
+            lirs.pages.erase(oldest);
+        }
+    } else {
+        lirs.pages.erase(page_no);
+    }
+    return victim;
+}
+
+// OPT: pop the frame with the furthest next use, skipping heap entries made stale by later
+// references to the same frame
+int optReplace(OptState& opt) {
+    while (!opt.heap.empty()) {
+        pair<uint64_t, int> top = opt.heap.top();
+        opt.heap.pop();
+        if (opt.frame_next_use[top.second] == top.first) {
+            // 0 is never a next use, so this retires every heap entry of the frame
+            opt.frame_next_use[top.second] = 0;
+            return top.second;
+        }
+    }
+    return -1;
+}
+
+// Record the next use of the page just referenced in frame_no
+void optSetNextUse(OptState& opt, int frame_no) {
+    opt.frame_next_use[frame_no] = opt.current_next_use;
+    opt.heap.push(make_pair(opt.current_next_use, frame_no));
+
+    // Hits leave stale entries behind; rebuild once they outnumber the live ones
+    int num_frames = (int)opt.frame_next_use.size();
+    if ((int)opt.heap.size() > 2 * num_frames + 64) {
+        vector<pair<uint64_t, int>> live;
+        live.reserve(num_frames);
+        for (int i = 0; i < num_frames; ++i) live.push_back(make_pair(opt.frame_next_use[i], i));
+        opt.heap = priority_queue<pair<uint64_t, int>>(less<pair<uint64_t, int>>(), move(live));
+    }
+}
+
+// Remove HIR pages from the bottom of S until an LIR page is at the bottom
+void lirsPruneStack(LirsState& lirs) {
+    while (!lirs.stack.empty()) {
+        int page_no = lirs.stack.front();
+        LirsEntry& entry = lirs.pages[page_no];
+        if (entry.lir) break;
+        lirs.stack.pop_front();
+        entry.in_stack = false;
+        if (!entry.resident) {
+            lirs.non_resident.remove(page_no);
+            lirs.pages.erase(page_no);
+        }
+    }
+}
+
+// Turn the LIR page at the bottom of S into a resident HIR page at the end of Q
+void lirsDemoteBottom(LirsState& lirs) {
+    if (lirs.stack.empty()) return;
+    int page_no = lirs.stack.front();
+    LirsEntry& entry = lirs.pages[page_no];
+    lirs.stack.pop_front();
+    entry.in_stack = false;
+    entry.lir = false;
+    lirs.lir_count--;
+    entry.queue_pos = lirs.queue.insert(lirs.queue.end(), page_no);
+    entry.in_queue = true;
+    lirsPruneStack(lirs);
+}
+
+// A page was just loaded into frame_no
+void onFrameLoaded(FrameTable& pageFrames, ReplacementState& replacement, int frame_no, const PageFault& fault) {
+    switch (replacement.algorithm) {
+    case ReplacementAlgorithm::FIFO:
+    case ReplacementAlgorithm::LRU:
+    case ReplacementAlgorithm::SECOND_CHANCE:
+        frameListPushBack(replacement.queue, pageFrames, frame_no);
+        break;
+    case ReplacementAlgorithm::ARC: {
+        ArcState& arc = replacement.arc;
+        pageFrames.queue_id[frame_no] = fault.load_into_frequent ? 2 : 1;
+        frameListPushBack(fault.load_into_frequent ? arc.t2 : arc.t1, pageFrames, frame_no);
+        break;
+    }
+    case ReplacementAlgorithm::TWO_Q: {
+        TwoQState& twoQ = replacement.twoQ;
+        pageFrames.queue_id[frame_no] = fault.load_into_frequent ? 2 : 1;
+        frameListPushBack(fault.load_into_frequent ? twoQ.am : twoQ.a1in, pageFrames, frame_no);
+        break;
+    }
+    case ReplacementAlgorithm::LIRS: {
+        LirsState& lirs = replacement.lirs;
+        int page_no = pageFrames.page_no[frame_no];
+        LirsEntry& entry = lirs.pages[page_no];
+        entry.resident = true;
+        entry.frame_no = frame_no;
+        if (entry.in_stack) {
+            // Reused while its ghost was still in S: short reuse distance, so it becomes LIR
+            lirs.non_resident.remove(page_no);
+            lirs.stack.erase(entry.stack_pos);
+            entry.lir = true;
+            lirs.lir_count++;
+        } else if (lirs.lir_count < lirs.lir_capacity) {
+            // Warm-up: the first pages fill the LIR set
+            entry.lir = true;
+            lirs.lir_count++;
+        } else {
+            entry.queue_pos = lirs.queue.insert(lirs.queue.end(), page_no);
+            entry.in_queue = true;
+        }
+        entry.stack_pos = lirs.stack.insert(lirs.stack.end(), page_no);
+        entry.in_stack = true;
+        if (lirs.lir_count > lirs.lir_capacity) lirsDemoteBottom(lirs);
+        break;
+    }
+    case ReplacementAlgorithm::OPT:
+        optSetNextUse(replacement.opt, frame_no);
+        break;
+    default:
+        // CLOCK variants only look at the referenced bit the PMT already carries
+        break;
+    }
+}
+
+// A resident page in frame_no was referenced again
+void onFrameReferenced(FrameTable& pageFrames, ReplacementState& replacement, int frame_no) {
+    switch (replacement.algorithm) {
+    case ReplacementAlgorithm::LRU:
+        if (replacement.queue.tail != frame_no) {
+            frameListRemove(replacement.queue, pageFrames, frame_no);
+            frameListPushBack(replacement.queue, pageFrames, frame_no);
+        }
+        break;
+    case ReplacementAlgorithm::ARC: {
+        ArcState& arc = replacement.arc;
+        // Any hit makes the page frequent: move it to the MRU end of T2
+        if (pageFrames.queue_id[frame_no] == 1) {
+            arc.t1_hits++;
+            frameListRemove(arc.t1, pageFrames, frame_no);
+        } else {
+            arc.t2_hits++;
+            frameListRemove(arc.t2, pageFrames, frame_no);
+        }
+        pageFrames.queue_id[frame_no] = 2;
+        frameListPushBack(arc.t2, pageFrames, frame_no);
+        break;
+    }
+    case ReplacementAlgorithm::TWO_Q: {
+        TwoQState& twoQ = replacement.twoQ;
+        // Hits in A1in deliberately do nothing so correlated references don't promote a page
+        if (pageFrames.queue_id[frame_no] == 2) {
+            twoQ.am_hits++;
+            frameListRemove(twoQ.am, pageFrames, frame_no);
+            frameListPushBack(twoQ.am, pageFrames, frame_no);
+        } else {
+            twoQ.a1in_hits++;
+        }
+        break;
+    }
+    case ReplacementAlgorithm::LIRS: {
+        LirsState& lirs = replacement.lirs;
+        int page_no = pageFrames.page_no[frame_no];
+        LirsEntry& entry = lirs.pages[page_no];
+        if (entry.lir) {
+            lirs.lir_hits++;
+            bool wasBottom = lirs.stack.front() == page_no;
+            lirs.stack.splice(lirs.stack.end(), lirs.stack, entry.stack_pos);
+            if (wasBottom) lirsPruneStack(lirs);
+        } else {
+            lirs.hir_hits++;
+            if (entry.in_stack) {
+                // Resident HIR page reused within the LIR set's recency: promote it
+                lirs.stack.splice(lirs.stack.end(), lirs.stack, entry.stack_pos);
+                lirs.queue.erase(entry.queue_pos);
+                entry.in_queue = false;
+                entry.lir = true;
+                lirs.lir_count++;
+                lirsDemoteBottom(lirs);
+            } else {
+                entry.stack_pos = lirs.stack.insert(lirs.stack.end(), page_no);
+                entry.in_stack = true;
+                lirs.queue.splice(lirs.queue.end(), lirs.queue, entry.queue_pos);
+            }
+        }
+        break;
+    }
+    case ReplacementAlgorithm::OPT:
+        optSetNextUse(replacement.opt, frame_no);
+        break;
+    default:
+        break;
+    }
+}
+
+// Print hit/miss counts for the run, with each policy's own breakdown
+void printReplacementStats(const ReplacementState& replacement) {
+    uint64_t hits = replacement.hits.load();
+    uint64_t total = hits + replacement.misses;
+    const LocalAllocationState& local = replacement.local;
+    if (local.mode != FrameAllocation::GLOBAL) {
+        // The global policy is not consulted, so report the allocator instead
+        cout << frameAllocationName(local.mode) << " hits: " << hits << ", misses: " << replacement.misses;
+        if (total > 0) cout << " (hit ratio " << 100.0 * hits / total << "%)";
+        cout << "\n  pages released " << local.released << ", suspensions " << local.suspensions
+             << ", resumptions " << local.resumptions << "\n";
+        return;
+    }
+    cout << algorithmName(replacement.algorithm) << " hits: " << hits << ", misses: " << replacement.misses;
+    if (total > 0) cout << " (hit ratio " << 100.0 * hits / total << "%)";
+    cout << "\n";
+    switch (replacement.algorithm) {
+    case ReplacementAlgorithm::ARC:
+        cout << "  T1 hits " << replacement.arc.t1_hits << ", T2 hits " << replacement.arc.t2_hits
+             << ", B1 ghost hits " << replacement.arc.b1_hits << ", B2 ghost hits " << replacement.arc.b2_hits
+             << ", final p " << replacement.arc.p << "\n";
+        break;
+    case ReplacementAlgorithm::TWO_Q:
+        cout << "  A1in hits " << replacement.twoQ.a1in_hits << ", Am hits " << replacement.twoQ.am_hits
+             << ", A1out ghost hits " << replacement.twoQ.a1out_hits << "\n";
+        break;
+    case ReplacementAlgorithm::LIRS:
+        cout << "  LIR hits " << replacement.lirs.lir_hits << ", HIR hits " << replacement.lirs.hir_hits
+             << ", non-resident HIR hits " << replacement.lirs.ghost_hits << "\n";
+        break;
+    default:
+        break;
+    }
+}
+
+// Accuracy is the share of prefetched pages that were used, coverage the share of would-be
+// faults that a prefetch turned into hits, and pollution faults are faults on pages that a
+// prefetch had evicted
+void printPrefetchStats(const vector<JobTableEntry>& jobTable) {
+    if (SIM->prefetch_window <= 0) return;
+    PagingCounters total = totalCounters(jobTable);
+    uint64_t issued = total.prefetches, used = total.prefetch_hits;
+    cout << "Prefetch: " << issued << " pages read ahead, " << used << " used";
+    if (issued > 0) cout << " (accuracy " << 100.0 * used / issued << "%)";
+    if (used + total.faults > 0) cout << ", coverage " << 100.0 * used / (used + total.faults) << "%";
+    cout << ", " << total.prefetch_wasted << " evicted unused, " << total.pollution_faults << " pollution faults\n";
+}
+
+// Reservations and what became of them; the fill counts show the price of promotion, pages read
+// in that were never referenced. TLB reach is the memory the TLB maps at the end of the run,
+// and the last lines compare the internal fragmentation of the jobs' last page in base and in
+// huge pages, the same way divideIntoPages accounts for it.
+void printHugePageStats(const vector<Job>& jobs, const ReplacementState& replacement) {
+    const HugePageState& huge = replacement.huge;
+    if (!huge.active) return;
+    uint64_t huge_bytes = (uint64_t)huge.pages * SIM->page_size;
+    cout << "Huge pages (" << huge_bytes << " bytes): " << huge.reserved << " regions reserved, " << huge.promotions << " promoted, "
+         << huge.demotions << " demoted, " << huge.broken << " reservations broken\n";
+    uint64_t unreferenced = huge.fills - huge.fill_hits - huge.fill_wasted;
+    cout << "  fills: " << huge.fills << " pages, " << huge.fill_hits << " referenced, " << huge.fill_wasted << " evicted unreferenced, "
+         << unreferenced << " still unreferenced (" << unreferenced * SIM->page_size << " bytes of huge-page fragmentation)\n";
+
+    int base_entries = 0, huge_entries = 0;
+    for (const auto& entry : SIM->tlb.contents()) {
+        if (entry.asid == -1) continue;
+        if (entry.vpn < -1) huge_entries++;
+        else base_entries++;
+    }
+    if (SIM->tlb.enabled()) {
+        uint64_t reach = (uint64_t)base_entries * SIM->page_size + (uint64_t)huge_entries * huge_bytes;
+        cout << "  TLB reach: " << reach << " bytes (" << base_entries << " base, " << huge_entries << " huge entries; "
+             << SIM->tlb.contents().size() * huge_bytes << " if all were huge), " << huge.tlb_hits << " hits on huge entries\n";
+    }
+
+    uint64_t base_waste = 0, huge_waste = 0;
+    for (const auto& job : jobs) {
+        base_waste += internalFragmentation(job.size, SIM->page_size);
+        huge_waste += internalFragmentation(job.size, huge_bytes);
+    }
+    cout << "  internal fragmentation of the jobs' last pages: " << base_waste << " bytes in base pages, " << huge_waste << " in huge pages\n";
+}
+
+void frameListPushBack(FrameList& list, FrameTable& pageFrames, int frame_no) {
+    pageFrames.prev[frame_no] = list.tail;
+    pageFrames.next[frame_no] = -1;
+    if (list.tail != -1) pageFrames.next[list.tail] = frame_no;
+    else list.head = frame_no;
+    list.tail = frame_no;
+    list.size++;
+}
+
+void frameListRemove(FrameList& list, FrameTable& pageFrames, int frame_no) {
+    int prev = pageFrames.prev[frame_no], next = pageFrames.next[frame_no];
+    if (prev != -1) pageFrames.next[prev] = next;
+    else list.head = next;
+    if (next != -1) pageFrames.prev[next] = prev;
+    else list.tail = prev;
+    pageFrames.prev[frame_no] = pageFrames.next[frame_no] = -1;
+    list.size--;
+}
+
+// Whether a policy reorders its lists on hits. Hits under the other policies only set the
+// referenced bit and never take replacement.lock.
+bool tracksHits(ReplacementAlgorithm algorithm) {
+    switch (algorithm) {
+    case ReplacementAlgorithm::FIFO:
+    case ReplacementAlgorithm::CLOCK:
+    case ReplacementAlgorithm::SECOND_CHANCE:
+    case ReplacementAlgorithm::ENHANCED_CLOCK:
+        return false;
+    default:
+        return true;
+    }
+}
+
+// Index of the highest set bit; word must not be zero
+int highestSetBit(uint64_t word) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, word);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(word);
+#endif
+}
+
+// Index of the lowest set bit; word must not be zero
+int countTrailingZeros(uint64_t word) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return (int)index;
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+void MemoryMapTable::init(int frames) {
+    num_frames = frames;
+    int words = (frames + 63) / 64;
+    occupied = vector<atomic<uint64_t>>(words);
+    has_free = vector<atomic<uint64_t>>((words + 63) / 64);
+    for (int w = 0; w < words; ++w) {
+        // Bits past the last frame stay set so they are never handed out
+        int valid = min(64, frames - w * 64);
+        occupied[w] = valid == 64 ? 0 : ~0ULL << valid;
+        has_free[w / 64] |= 1ULL << (w % 64);
+    }
+    free_frames = frames;
+}
+
+// Claim the lowest free frame and mark it occupied. Returns -1 when memory is full.
+// Two faults never get the same frame: the bit is taken with a compare-and-swap.
+int MemoryMapTable::claimFreeFrame() {
+    if (free_frames.load(memory_order_relaxed) <= 0) return -1;
+    for (int s = 0; s < (int)has_free.size(); ++s) {
+        uint64_t summary = has_free[s].load(memory_order_relaxed);
+        while (summary != 0) {
+            int w = s * 64 + countTrailingZeros(summary);
+            uint64_t word = occupied[w].load(memory_order_relaxed);
+            while (word != ~0ULL) {
+                int bit = countTrailingZeros(~word);
+                if (occupied[w].compare_exchange_weak(word, word | (1ULL << bit), memory_order_acq_rel)) {
+                    free_frames.fetch_sub(1, memory_order_relaxed);
+                    if ((word | (1ULL << bit)) == ~0ULL) {
+                        // Word is full now; clear its summary bit, then re-set it if a frame
+                        // was released in between so the release isn't lost
+                        has_free[s].fetch_and(~(1ULL << (w % 64)), memory_order_acq_rel);
+                        if (occupied[w].load(memory_order_acquire) != ~0ULL) has_free[s].fetch_or(1ULL << (w % 64), memory_order_acq_rel);
+                    }
+                    return w * 64 + bit;
+                }
+            }
+            summary &= summary - 1;
+        }
+    }
+    return -1;
+}
+
+// Return a frame to the free pool
+void MemoryMapTable::release(int frame_no) {
+    int w = frame_no / 64;
+    occupied[w].fetch_and(~(1ULL << (frame_no % 64)), memory_order_acq_rel);
+    has_free[w / 64].fetch_or(1ULL << (w % 64), memory_order_acq_rel);
+    free_frames.fetch_add(1, memory_order_relaxed);
+}
+
+// Claim an aligned run of free frames (a power of two) for a huge-page reservation and mark it
+// occupied. Runs are searched from the top of memory, away from the base frames that
+// claimFreeFrame hands out from the bottom. Returns the first frame, or -1 if there is no run.
+int MemoryMapTable::claimRun(int frames) {
+    if (free_frames.load(memory_order_relaxed) < frames) return -1;
+    auto markFull = [&](int w) {
+        has_free[w / 64].fetch_and(~(1ULL << (w % 64)), memory_order_acq_rel);
+        if (occupied[w].load(memory_order_acquire) != ~0ULL) has_free[w / 64].fetch_or(1ULL << (w % 64), memory_order_acq_rel);
+    };
+    if (frames < 64) {
+        // Runs share words: take a group of bits in one compare-and-swap
+        uint64_t group = (1ULL << frames) - 1;
+        for (int w = (int)occupied.size() - 1; w >= 0; --w) {
+            uint64_t word = occupied[w].load(memory_order_relaxed);
+            for (int bit = 64 - frames; bit >= 0; bit -= frames) {
+                uint64_t mask = group << bit;
+                while ((word & mask) == 0) {
+                    if (occupied[w].compare_exchange_weak(word, word | mask, memory_order_acq_rel)) {
+                        free_frames.fetch_sub(frames, memory_order_relaxed);
+                        if ((word | mask) == ~0ULL) markFull(w);
+                        return w * 64 + bit;
+                    }
+                }
+            }
+        }
+        return -1;
+    }
+    // Runs span whole words: take them one by one and give them back if one is taken meanwhile
+    int words = frames / 64;
+    for (int first = ((int)occupied.size() / words - 1) * words; first >= 0; first -= words) {
+        int taken = 0;
+        for (; taken < words; ++taken) {
+            uint64_t expected = 0;
+            if (!occupied[first + taken].compare_exchange_strong(expected, ~0ULL, memory_order_acq_rel)) break;
+        }
+        if (taken == words) {
+            free_frames.fetch_sub(frames, memory_order_relaxed);
+            for (int w = first; w < first + words; ++w) markFull(w);
+            return first * 64;
+        }
+        for (int w = first; w < first + taken; ++w) occupied[w].store(0, memory_order_release);
+    }
+    return -1;
+}
+
+bool Tlb::configure(int num_entries, int num_ways, TlbReplacement tlb_policy) {
+    if (num_entries < 0 || num_ways < 0) return false;
+    if (num_ways == 0 || num_ways > num_entries) num_ways = num_entries;
+    if (num_entries > 0 && num_entries % num_ways != 0) return false;
+    num_sets = num_entries > 0 ? num_entries / num_ways : 0;
+    ways = num_ways;
+    policy = tlb_policy;
+    entries = vector<TlbEntry>(num_entries);
+    locks = vector<atomic<bool>>(num_sets);
+    ticks = vector<uint64_t>(num_sets);
+    flush();
+    return true;
+}
+
+// Invalidate every entry and reset the counters; called at the start of each run
+void Tlb::flush() {
+    for (auto& entry : entries) entry = TlbEntry();
+    for (auto& tick : ticks) tick = 0;
+    hits = 0;
+    misses = 0;
+}
+
+// Look up a translation, counting a TLB hit or miss. Does nothing when the TLB is disabled.
+bool Tlb::lookup(int asid, int vpn, int& frame_no, PageMapTableEntry*& pte) {
+    if (!enabled()) return false;
+    int set = setOf(vpn);
+    lockSet(set);
+    TlbEntry* first = &entries[set * ways];
+    for (int w = 0; w < ways; ++w) {
+        if (first[w].asid == asid && first[w].vpn == vpn) {
+            if (policy == TlbReplacement::LRU) first[w].stamp = ++ticks[set];
+            frame_no = first[w].frame_no;
+            pte = first[w].pte;
+            unlockSet(set);
+            hits++;
+            return true;
+        }
+    }
+    unlockSet(set);
+    misses++;
+    return false;
+}
+
+// Cache the mapping in a PMT entry. The entry is re-read under the set lock: an eviction clears
+// status before it invalidates, so a mapping that is current here is never left behind stale.
+void Tlb::insert(int asid, int vpn, PageMapTableEntry& row) {
+    if (!enabled()) return;
+    int set = setOf(vpn);
+    lockSet(set);
+    uint64_t bits = row.word;
+    int frame_no = PageMapTableEntry::frameOf(bits);
+    if (bits & PageMapTableEntry::PRESENT) {
+        TlbEntry* first = &entries[set * ways];
+        TlbEntry* victim = nullptr;
+        for (int w = 0; w < ways && !victim; ++w) {
+            if (first[w].asid == -1 || (first[w].asid == asid && first[w].vpn == vpn)) victim = &first[w];
+        }
+        if (!victim) {
+            if (policy == TlbReplacement::RANDOM) {
+                // A multiplicative hash of the set's clock is random enough and reproducible
+                victim = &first[((ticks[set] + 1) * 0x9E3779B97F4A7C15ULL >> 32) % ways];
+            } else {
+                // Smallest stamp: least recently used (LRU) or oldest fill (FIFO)
+                victim = first;
+                for (int w = 1; w < ways; ++w) {
+                    if (first[w].stamp < victim->stamp) victim = &first[w];
+                }
+            }
+        }
+        victim->asid = asid;
+        victim->vpn = vpn;
+        victim->frame_no = frame_no;
+        victim->pte = &row;
+        victim->stamp = ++ticks[set];
+    }
+    unlockSet(set);
+}
+
+// Drop the translation of an evicted page
+void Tlb::invalidate(int asid, int vpn) {
+    if (!enabled()) return;
+    int set = setOf(vpn);
+    lockSet(set);
+    TlbEntry* first = &entries[set * ways];
+    for (int w = 0; w < ways; ++w) {
+        if (first[w].asid == asid && first[w].vpn == vpn) first[w] = TlbEntry();
+    }
+    unlockSet(set);
+}
+
+// Print TLB hit/miss counts; these are translations, separate from page faults
+void Tlb::printStats() const {
+    if (!enabled()) return;
+    uint64_t total = hits + misses;
+    cout << "TLB (" << entries.size() << " entries, ";
+    if (num_sets == 1) cout << "fully associative";
+    else cout << ways << "-way";
+    cout << ", " << tlbReplacementName(policy) << ") hits: " << hits << ", misses: " << misses;
+    if (total > 0) cout << " (hit ratio " << 100.0 * hits / total << "%, miss ratio " << 100.0 * misses / total << "%)";
+    cout << "\n";
+}
+
+bool SwapDevice::configure(uint64_t read_latency, uint64_t write_latency, double read_mb_s, double write_mb_s, int depth, int cluster_pages, bool sync) {
+    if (read_mb_s <= 0 || write_mb_s <= 0 || depth < 1 || cluster_pages < 1) return false;
+    read_latency_ns = read_latency;
+    write_latency_ns = write_latency;
+    read_ns_per_byte = 1000.0 / read_mb_s;
+    write_ns_per_byte = 1000.0 / write_mb_s;
+    queue_depth = depth;
+    cluster = cluster_pages;
+    sync_writes = sync;
+    return true;
+}
+
+void SwapDevice::configureLike(const SwapDevice& other) {
+    read_latency_ns = other.read_latency_ns;
+    write_latency_ns = other.write_latency_ns;
+    read_ns_per_byte = other.read_ns_per_byte;
+    write_ns_per_byte = other.write_ns_per_byte;
+    queue_depth = other.queue_depth;
+    cluster = other.cluster;
+    sync_writes = other.sync_writes;
+}
+
+// Idle the device and drop its statistics for a new run
+void SwapDevice::reset(int num_frames) {
+    lock_guard<mutex> guard(lock);
+    slot_free.assign(queue_depth, 0);
+    write_buffer.clear();
+    write_done.clear();
+    ready_at.assign(num_frames, 0);
+    reads = read_requests = writes = write_requests = buffer_hits = 0;
+    busy_ns = read_wait_ns = 0;
+}
+
+// Queue a request of whole pages arriving at simulated time `at` on the slot that frees up
+// first; returns when it completes. Called with the device lock held.
+uint64_t SwapDevice::submit(uint64_t at, int pages, bool is_write) {
+    auto slot = min_element(slot_free.begin(), slot_free.end());
+    uint64_t begin = max(at, *slot);
+    double transfer = (double)pages * SIM->page_size * (is_write ? write_ns_per_byte : read_ns_per_byte);
+    uint64_t done = begin + (is_write ? write_latency_ns : read_latency_ns) + (uint64_t)transfer;
+    *slot = done;
+    busy_ns += done - begin;
+    return done;
+}
+
+// Write the buffered pages as one request; returns its completion, or `at` if there was none
+uint64_t SwapDevice::issueWrites(uint64_t at) {
+    if (write_buffer.empty()) return at;
+    // Completed writes no longer hold back reads
+    if (write_done.size() > 4 * slot_free.size() * cluster + 64) {
+        for (auto it = write_done.begin(); it != write_done.end();) {
+            if (it->second <= at) it = write_done.erase(it);
+            else ++it;
+        }
+    }
+    uint64_t done = submit(at, (int)write_buffer.size(), true);
+    for (int page_no : write_buffer) write_done[page_no] = done;
+    writes += write_buffer.size();
+    write_requests++;
+    write_buffer.clear();
+    return done;
+}
+
+void SwapDevice::stallUntil(PagingCounters& job, uint64_t until) {
+    uint64_t now = job.clock_ns;
+    if (until <= now) return;
+    job.clock_ns.fetch_add(until - now, memory_order_relaxed);
+    job.stall_ns.fetch_add(until - now, memory_order_relaxed);
+}
+
+// A dirty page was evicted to make room for `job`. It joins the write buffer, which goes out
+// once a cluster is full; with sync_writes it goes out at once and the job waits for it.
+void SwapDevice::writeBack(PagingCounters& job, int page_no) {
+    lock_guard<mutex> guard(lock);
+    write_buffer.push_back(page_no);
+    if (sync_writes) stallUntil(job, issueWrites(job.clock_ns));
+    else if ((int)write_buffer.size() >= cluster) issueWrites(job.clock_ns);
+}
+
+// Demand read of a page; the job stalls until it arrives
+void SwapDevice::pageIn(PagingCounters& job, int page_no) {
+    lock_guard<mutex> guard(lock);
+    if (find(write_buffer.begin(), write_buffer.end(), page_no) != write_buffer.end()) {
+        buffer_hits++;
+        return;
+    }
+    uint64_t at = job.clock_ns;
+    auto written = write_done.find(page_no);
+    if (written != write_done.end()) {
+        at = max(at, written->second);
+        write_done.erase(written);
+    }
+    uint64_t done = submit(at, 1, false);
+    reads++;
+    read_requests++;
+    read_wait_ns += done - job.clock_ns;
+    stallUntil(job, done);
+}
+
+// Read ahead into a frame without stalling; a reference before the read completes waits for it
+void SwapDevice::prefetchIn(PagingCounters& job, int page_no, int frame_no) {
+    lock_guard<mutex> guard(lock);
+    uint64_t at = job.clock_ns;
+    auto written = write_done.find(page_no);
+    if (written != write_done.end()) {
+        at = max(at, written->second);
+        write_done.erase(written);
+    }
+    ready_at[frame_no] = submit(at, 1, false);
+    reads++;
+    read_requests++;
+}
+
+void SwapDevice::waitReady(PagingCounters& job, int frame_no) {
+    lock_guard<mutex> guard(lock);
+    stallUntil(job, ready_at[frame_no]);
+}
+
+// Write out what is left in the buffer at the end of a run
+void SwapDevice::flush(const vector<JobTableEntry>& jobTable) {
+    uint64_t end = 0;
+    for (const auto& job : jobTable) end = max(end, job.counters.clock_ns.load());
+    lock_guard<mutex> guard(lock);
+    issueWrites(end);
+}
+
+// Print device traffic and utilisation, and per job the time spent stalled on it
+void SwapDevice::printStats(const vector<JobTableEntry>& jobTable) const {
+    lock_guard<mutex> guard(lock);
+    uint64_t makespan = 0, stalled = 0;
+    for (const auto& job : jobTable) {
+        makespan = max(makespan, job.counters.clock_ns.load());
+        stalled += job.counters.stall_ns;
+    }
+    for (uint64_t done : slot_free) makespan = max(makespan, done);
+    cout << "Swap device: " << reads << " pages read, " << writes << " written in " << write_requests << " requests";
+    if (buffer_hits > 0) cout << ", " << buffer_hits << " faults served from the write buffer";
+    cout << "\n";
+    if (makespan == 0) return;
+    cout << "  utilisation " << 100.0 * busy_ns / ((double)queue_depth * makespan) << "% of " << queue_depth << " queue slots over "
+         << makespan / 1e6 << " ms";
+    if (read_requests > 0) cout << ", mean read wait " << read_wait_ns / read_requests / 1000.0 << " us";
+    cout << ", jobs stalled " << stalled / 1e6 << " ms in total\n";
+    const int MAX_JOBS_LISTED = 16;
+    for (int j = 0; j < (int)jobTable.size() && j < MAX_JOBS_LISTED; ++j) {
+        const PagingCounters& counters = jobTable[j].counters;
+        uint64_t run = counters.clock_ns;
+        cout << "  Job " << jobTable[j].job_no << ": ran " << run / 1e6 << " ms, stalled " << counters.stall_ns / 1e6 << " ms";
+        if (run > 0) cout << " (" << 100.0 * counters.stall_ns / run << "%)";
+        cout << "\n";
+    }
+    if ((int)jobTable.size() > MAX_JOBS_LISTED) cout << "  ... " << jobTable.size() - MAX_JOBS_LISTED << " more jobs\n";
+}
+
+EventLog::~EventLog() {
+    stop();
+    if (out != stdout) fclose(out);
+}
+
+bool EventLog::configure(LogLevel log_level, LogFormat log_format, const string& path) {
+    level = log_level;
+    format = log_format;
+    if (!path.empty()) {
+        out = fopen(path.c_str(), log_format == LogFormat::BINARY ? "wb" : "w");
+        if (!out) {
+            out = stdout;
+            cout << "Cannot open " << path << " for writing\n";
+            return false;
+        }
+    }
+    if (format == LogFormat::BINARY && level != LogLevel::SILENT) {
+        EventFileHeader header = {};
+        memcpy(header.magic, EVENT_MAGIC, 4);
+        header.version = EVENT_VERSION;
+        header.page_size = (uint32_t)SIM->page_size;
+        header.record_size = sizeof(LogEvent);
+        fwrite(&header, sizeof(header), 1, out);
+    }
+    return true;
+}
+
+// Start the writer for a run; the shadow frames start out empty like the run's memory
+void EventLog::start() {
+    if (level == LogLevel::SILENT || running) return;
+    page_size = SIM->page_size;
+    shadow.clear();
+    changed.clear();
+    is_changed.clear();
+    running = true;
+    active = level;
+    writer = thread(&EventLog::writerLoop, this);
+}
+
+// Stop producing events and write out everything still buffered. Job threads must be done.
+void EventLog::stop() {
+    if (!running) return;
+    active = LogLevel::SILENT;
+    running = false;
+    writer.join();
+    fflush(out);
+}
+
+EventRing& EventLog::threadRing() {
+    // A thread keeps its ring for as long as it logs to the same event log
+    thread_local EventRing* ring = nullptr;
+    thread_local const EventLog* ring_log = nullptr;
+    if (!ring || ring_log != this) {
+        lock_guard<mutex> lock(rings_lock);
+        rings.push_back(unique_ptr<EventRing>(new EventRing()));
+        ring = rings.back().get();
+        ring_log = this;
+    }
+    return *ring;
+}
+
+// Append an event to the calling thread's ring, waiting for the writer while it is full
+void EventLog::emit(LogEventType type, uint64_t time, int job_no, int page_no, int frame_no, uint64_t value) {
+    EventRing& ring = threadRing();
+    uint64_t tail = ring.tail.load(memory_order_relaxed);
+    while (tail - ring.head.load(memory_order_acquire) >= EventRing::CAPACITY) this_thread::yield();
+    LogEvent& event = ring.events[tail & (EventRing::CAPACITY - 1)];
+    event.time = time;
+    event.value = value;
+    event.job_no = job_no;
+    event.page_no = page_no;
+    event.frame_no = frame_no;
+    event.type = type;
+    ring.tail.store(tail + 1, memory_order_release);
+}
+
+void EventLog::writerLoop() {
+    while (running) {
+        if (!drain()) this_thread::sleep_for(chrono::microseconds(200));
+    }
+    while (drain()) {}
+}
+
+// One pass over every ring; returns whether there was anything to write
+bool EventLog::drain() {
+    vector<EventRing*> pending;
+    {
+        lock_guard<mutex> lock(rings_lock);
+        for (auto& ring : rings) pending.push_back(ring.get());
+    }
+    bool any = false;
+    uint64_t last_time = 0;
+    for (EventRing* ring : pending) {
+        uint64_t head = ring->head.load(memory_order_relaxed);
+        uint64_t tail = ring->tail.load(memory_order_acquire);
+        for (; head != tail; ++head) {
+            const LogEvent& event = ring->events[head & (EventRing::CAPACITY - 1)];
+            write(event);
+            last_time = max(last_time, event.time);
+        }
+        if (head != ring->head.load(memory_order_relaxed)) {
+            ring->head.store(head, memory_order_release);
+            any = true;
+        }
+    }
+    if (level == LogLevel::SNAPSHOTS && !changed.empty()) writeSnapshot(last_time);
+    return any;
+}
+
+void EventLog::markFrame(int frame_no, int job_no, int page_no) {
+    if (frame_no >= (int)shadow.size()) {
+        shadow.resize(frame_no + 1, make_pair(-1, -1));
+        is_changed.resize(frame_no + 1, false);
+    }
+    shadow[frame_no] = make_pair(job_no, page_no);
+    if (!is_changed[frame_no]) {
+        is_changed[frame_no] = true;
+        changed.push_back(frame_no);
+    }
+}
+
+void EventLog::write(const LogEvent& event) {
+    if (event.type == LogEventType::EVICT) markFrame(event.frame_no, -1, -1);
+    if (event.type == LogEventType::LOAD || event.type == LogEventType::PREFETCH) markFrame(event.frame_no, event.job_no, event.page_no);
+
+    if (format == LogFormat::BINARY) {
+        fwrite(&event, sizeof(event), 1, out);
+        return;
+    }
+    if (format == LogFormat::NDJSON) {
+        static const char* names[] = {"job", "hit", "fault", "evict", "load", "resolve", "frame", "suspend", "resume", "prefetch"};
+        fprintf(out, "{\"t\":%llu,\"event\":\"%s\",\"job\":%d", (unsigned long long)event.time, names[(int)event.type], event.job_no);
+        if (event.type == LogEventType::JOB) fprintf(out, ",\"pages\":%llu}\n", (unsigned long long)event.value);
+        else if (event.type == LogEventType::SUSPEND || event.type == LogEventType::RESUME) fprintf(out, ",\"frames\":%llu}\n", (unsigned long long)event.value);
+        else if (event.type == LogEventType::RESOLVE) fprintf(out, ",\"address\":%llu,\"frame\":%d}\n", (unsigned long long)event.value, event.frame_no);
+        else fprintf(out, ",\"page\":%d,\"frame\":%d}\n", event.page_no, event.frame_no);
+        return;
+    }
+    switch (event.type) {
+    case LogEventType::JOB:
+        if (event.value == 0) fprintf(out, "Job %d has no pages (size 0). Skipping.\n", event.job_no + 1);
+        else fprintf(out, "\nJob %d is running...\n", event.job_no + 1);
+        break;
+    case LogEventType::HIT:
+        fprintf(out, "Requesting Page %d of Job %d -> Page already in memory (Frame %d)\n", event.page_no, event.job_no + 1, event.frame_no);
+        break;
+    case LogEventType::FAULT:
+        fprintf(out, "Requesting Page %d of Job %d -> Page Fault occurred!\n", event.page_no, event.job_no + 1);
+        break;
+    case LogEventType::EVICT:
+        fprintf(out, " -> Replacing Frame %d (Page %d of Job %d)\n", event.frame_no, event.page_no, event.job_no + 1);
+        break;
+    case LogEventType::LOAD:
+        fprintf(out, " -> Loaded Page %d of Job %d into Frame %d\n", event.page_no, event.job_no + 1, event.frame_no);
+        break;
+    case LogEventType::RESOLVE:
+        fprintf(out, "%s\n", addressResolution(event.value, page_size, event.frame_no).c_str());
+        break;
+    case LogEventType::PREFETCH:
+        fprintf(out, " -> Prefetched Page %d of Job %d into Frame %d\n", event.page_no, event.job_no + 1, event.frame_no);
+        break;
+    case LogEventType::SUSPEND:
+        fprintf(out, "Load control suspended Job %d, releasing %llu frames\n", event.job_no + 1, (unsigned long long)event.value);
+        break;
+    case LogEventType::RESUME:
+        fprintf(out, "Job %d resumed (%llu frames before suspension)\n", event.job_no + 1, (unsigned long long)event.value);
+        break;
+    case LogEventType::FRAME:
+        break;
+    }
+}
+
+// Report the frames changed since the last snapshot, then start collecting afresh
+void EventLog::writeSnapshot(uint64_t time) {
+    sort(changed.begin(), changed.end());
+    if (format == LogFormat::BINARY) {
+        for (int frame_no : changed) {
+            LogEvent event = {};
+            event.time = time;
+            event.type = LogEventType::FRAME;
+            event.frame_no = frame_no;
+            event.job_no = shadow[frame_no].first;
+            event.page_no = shadow[frame_no].second;
+            fwrite(&event, sizeof(event), 1, out);
+        }
+    } else if (format == LogFormat::NDJSON) {
+        fprintf(out, "{\"t\":%llu,\"event\":\"snapshot\",\"frames\":[", (unsigned long long)time);
+        for (size_t i = 0; i < changed.size(); ++i) {
+            int frame_no = changed[i];
+            fprintf(out, "%s{\"frame\":%d,\"job\":%d,\"page\":%d}", i ? "," : "", frame_no, shadow[frame_no].first, shadow[frame_no].second);
+        }
+        fprintf(out, "]}\n");
+    } else {
+        fprintf(out, " Memory frames changed:\n");
+        for (int frame_no : changed) {
+            if (shadow[frame_no].first < 0) fprintf(out, "  Frame %d: [Empty]\n", frame_no);
+            else fprintf(out, "  Frame %d: Job %d, Page %d\n", frame_no, shadow[frame_no].first + 1, shadow[frame_no].second);
+        }
+        fprintf(out, "\n");
+    }
+    for (int frame_no : changed) is_changed[frame_no] = false;
+    changed.clear();
+}
+
+bool parseFrameAllocation(const string& name, FrameAllocation& mode) {
+    if (name == "global") mode = FrameAllocation::GLOBAL;
+    else if (name == "ws") mode = FrameAllocation::WORKING_SET;
+    else if (name == "pff") mode = FrameAllocation::PFF;
+    else return false;
+    return true;
+}
+
+const char* frameAllocationName(FrameAllocation mode) {
+    switch (mode) {
+    case FrameAllocation::GLOBAL: return "global";
+    case FrameAllocation::WORKING_SET: return "working set";
+    case FrameAllocation::PFF: return "PFF";
+    }
+    return "?";
+}
+
+bool parseAlgorithm(const string& name, ReplacementAlgorithm& algorithm) {
+    if (name == "FIFO") algorithm = ReplacementAlgorithm::FIFO;
+    else if (name == "LRU") algorithm = ReplacementAlgorithm::LRU;
+    else if (name == "CLOCK") algorithm = ReplacementAlgorithm::CLOCK;
+    else if (name == "SC" || name == "SECOND-CHANCE") algorithm = ReplacementAlgorithm::SECOND_CHANCE;
+    else if (name == "ECLOCK" || name == "ENHANCED-CLOCK") algorithm = ReplacementAlgorithm::ENHANCED_CLOCK;
+    else if (name == "ARC") algorithm = ReplacementAlgorithm::ARC;
+    else if (name == "2Q") algorithm = ReplacementAlgorithm::TWO_Q;
+    else if (name == "LIRS") algorithm = ReplacementAlgorithm::LIRS;
+    else if (name == "OPT") algorithm = ReplacementAlgorithm::OPT;
+    else return false;
+    return true;
+}
+
+const char* algorithmName(ReplacementAlgorithm algorithm) {
+    switch (algorithm) {
+    case ReplacementAlgorithm::FIFO: return "FIFO";
+    case ReplacementAlgorithm::LRU: return "LRU";
+    case ReplacementAlgorithm::CLOCK: return "CLOCK";
+    case ReplacementAlgorithm::SECOND_CHANCE: return "SECOND-CHANCE";
+    case ReplacementAlgorithm::ENHANCED_CLOCK: return "ENHANCED-CLOCK";
+    case ReplacementAlgorithm::ARC: return "ARC";
+    case ReplacementAlgorithm::TWO_Q: return "2Q";
+    case ReplacementAlgorithm::LIRS: return "LIRS";
+    case ReplacementAlgorithm::OPT: return "OPT";
+    }
+    return "?";
+}
+
+bool parseTlbReplacement(const string& name, TlbReplacement& policy) {
+    if (name == "LRU") policy = TlbReplacement::LRU;
+    else if (name == "FIFO") policy = TlbReplacement::FIFO;
+    else if (name == "RANDOM") policy = TlbReplacement::RANDOM;
+    else return false;
+    return true;
+}
+
+const char* tlbReplacementName(TlbReplacement policy) {
+    switch (policy) {
+    case TlbReplacement::LRU: return "LRU";
+    case TlbReplacement::FIFO: return "FIFO";
+    case TlbReplacement::RANDOM: return "RANDOM";
+    }
+    return "?";
+}
+
+// Address resolution from logical to physical
+string addressResolution(uint64_t logical_addr, int page_size, int frame_no) {
+    if (frame_no < 0) return " -> Address resolution failed: page not in memory";
+    PageGeometry geometry(page_size);
+    uint64_t page_no = geometry.pageOf(logical_addr);
+    uint64_t offset = geometry.offsetOf(logical_addr);
+    uint64_t physical_addr = (uint64_t)frame_no * page_size + offset;
+    return " -> Logical Address " + to_string(logical_addr) + " => Page " + to_string(page_no) + ", Offset " + to_string(offset)
+         + " => Physical Address " + to_string(physical_addr);
+}
+
+// Translate count logical addresses of one job through its PMT into physical[i], or -1 where
+// the page is beyond the job or not in memory. Only reads the PMT: no referenced bits, TLB or
+// policy updates, so faults are not taken. Flat PMTs with a power-of-two page size go four
+// addresses at a time with AVX2 gathers, or two with SSE2; the rest one at a time.
+void translateBatch(const JobTableEntry& job, vector<PageTable>& pageMapTables, const uint64_t* logical, size_t count, int64_t* physical) {
+    static_assert(PageMapTableEntry::PRESENT == 1ULL << 32 && sizeof(PageMapTableEntry) == 8, "the vector paths read PMT words directly");
+    PageTable& table = pageMapTables[job.PMT_ID];
+    PageGeometry geometry(SIM->page_size);
+    const PageMapTableEntry* flat = table.flatEntries();
+    size_t i = 0;
+    if (flat && geometry.shift >= 0) {
+#if defined(__AVX2__)
+        const long long* words = (const long long*)flat;
+        __m128i shift = _mm_cvtsi32_si128(geometry.shift);
+        // AVX2 only compares signed: flip the sign bits so a vpn of 2^63 or more is out of range too
+        __m256i sign = _mm256_set1_epi64x((long long)(1ULL << 63));
+        __m256i pages = _mm256_xor_si256(_mm256_set1_epi64x(table.numPages()), sign);
+        __m256i offset_mask = _mm256_set1_epi64x((long long)geometry.mask);
+        __m256i present = _mm256_set1_epi64x((long long)PageMapTableEntry::PRESENT);
+        __m256i frame_mask = _mm256_set1_epi64x((long long)PageMapTableEntry::FRAME_MASK);
+        __m256i one = _mm256_set1_epi64x(1), none = _mm256_set1_epi64x(-1);
+        for (; i + 4 <= count; i += 4) {
+            __m256i addr = _mm256_loadu_si256((const __m256i*)(logical + i));
+            __m256i vpn = _mm256_srl_epi64(addr, shift);
+            // Lanes beyond the table are not loaded; their word stays 0, not present
+            __m256i in_range = _mm256_cmpgt_epi64(pages, _mm256_xor_si256(vpn, sign));
+            __m256i word = _mm256_mask_i64gather_epi64(_mm256_setzero_si256(), words, vpn, in_range, 8);
+            __m256i is_present = _mm256_cmpeq_epi64(_mm256_and_si256(word, present), present);
+            __m256i frame = _mm256_sub_epi64(_mm256_and_si256(word, frame_mask), one);
+            __m256i phys = _mm256_or_si256(_mm256_sll_epi64(frame, shift), _mm256_and_si256(addr, offset_mask));
+            _mm256_storeu_si256((__m256i*)(physical + i), _mm256_blendv_epi8(none, phys, is_present));
+        }
+#elif defined(__x86_64__) || defined(_M_X64)
+        // SSE2 has no gather and no 64-bit compares: load the two words singly and turn the
+        // present bit (bit 32) into a lane mask by shifting it down and negating it
+        uint64_t num_pages = (uint64_t)table.numPages();
+        __m128i shift = _mm_cvtsi32_si128(geometry.shift);
+        __m128i offset_mask = _mm_set1_epi64x((long long)geometry.mask);
+        __m128i frame_mask = _mm_set1_epi64x((long long)PageMapTableEntry::FRAME_MASK);
+        __m128i one = _mm_set1_epi64x(1), none = _mm_set1_epi64x(-1);
+        for (; i + 2 <= count; i += 2) {
+            __m128i addr = _mm_loadu_si128((const __m128i*)(logical + i));
+            __m128i vpn = _mm_srl_epi64(addr, shift);
+            uint64_t vpn0 = (uint64_t)_mm_cvtsi128_si64(vpn), vpn1 = (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(vpn, vpn));
+            uint64_t word0 = vpn0 < num_pages ? flat[vpn0].word.load(memory_order_relaxed) : 0;
+            uint64_t word1 = vpn1 < num_pages ? flat[vpn1].word.load(memory_order_relaxed) : 0;
+            __m128i word = _mm_set_epi64x((long long)word1, (long long)word0);
+            __m128i is_present = _mm_sub_epi64(_mm_setzero_si128(), _mm_and_si128(_mm_srli_epi64(word, 32), one));
+            __m128i frame = _mm_sub_epi64(_mm_and_si128(word, frame_mask), one);
+            __m128i phys = _mm_or_si128(_mm_sll_epi64(frame, shift), _mm_and_si128(addr, offset_mask));
+            _mm_storeu_si128((__m128i*)(physical + i), _mm_or_si128(_mm_and_si128(is_present, phys), _mm_andnot_si128(is_present, none)));
+        }
+#endif
+    }
+    // The remainder, radix tables and page sizes that are not a power of two
+    for (; i < count; ++i) {
+        uint64_t vpn = geometry.pageOf(logical[i]);
+        PageMapTableEntry* entry = vpn < (uint64_t)table.numPages() ? table.find((int)vpn) : nullptr;
+        uint64_t word = entry ? entry->word.load(memory_order_relaxed) : 0;
+        physical[i] = (word & PageMapTableEntry::PRESENT)
+            ? (int64_t)((uint64_t)PageMapTableEntry::frameOf(word) * geometry.size + geometry.offsetOf(logical[i]))
+            : -1;
+    }
+}
+
+int LatencyHistogram::bucketOf(uint64_t value) {
+    if (value < (1ULL << SUB_BITS)) return (int)value;
+    int exponent = highestSetBit(value) - SUB_BITS + 1;
+    return (exponent << SUB_BITS) + (int)((value >> (exponent - 1)) - (1ULL << SUB_BITS));
+}
+
+// Smallest value that falls into a bucket
+uint64_t LatencyHistogram::bucketLow(int bucket) {
+    int exponent = bucket >> SUB_BITS;
+    uint64_t mantissa = bucket & ((1 << SUB_BITS) - 1);
+    if (exponent == 0) return mantissa;
+    return ((1ULL << SUB_BITS) + mantissa) << (exponent - 1);
+}
+
+void LatencyHistogram::record(uint64_t value) {
+    counts[bucketOf(value)].fetch_add(1, memory_order_relaxed);
+    sum.fetch_add(value, memory_order_relaxed);
+    uint64_t seen = max_value.load(memory_order_relaxed);
+    while (value > seen && !max_value.compare_exchange_weak(seen, value, memory_order_relaxed)) {}
+}
+
+void LatencyHistogram::mergeInto(vector<uint64_t>& totals, uint64_t& total_sum, uint64_t& total_max) const {
+    totals.resize(BUCKETS, 0);
+    for (int b = 0; b < BUCKETS; ++b) totals[b] += counts[b].load(memory_order_relaxed);
+    total_sum += sum.load(memory_order_relaxed);
+    total_max = max(total_max, max_value.load(memory_order_relaxed));
+}
+
+// A merged histogram as the exporters see it
+struct HistogramSnapshot {
+    vector<uint64_t> counts;
+    uint64_t count = 0, sum = 0, max_value = 0;
+
+    // Upper end of the bucket holding the given fraction of all values
+    uint64_t percentile(double fraction) const {
+        uint64_t rank = (uint64_t)ceil(fraction * count), seen = 0;
+        for (int b = 0; b < (int)counts.size(); ++b) {
+            seen += counts[b];
+            if (seen >= rank && seen > 0) return min(max_value, LatencyHistogram::bucketLow(b + 1) - 1);
+        }
+        return max_value;
+    }
+};
+
+const size_t MAX_JOB_SERIES = 64;     // per-job resident series only for runs up to this many jobs
+const size_t MAX_RSS_SAMPLES = 4096;  // when full, every other sample is dropped and the rate halves
+
+void Metrics::configure(const string& file_prefix, double interval_seconds, uint64_t sample_references) {
+    prefix = file_prefix;
+    interval = interval_seconds > 0 ? interval_seconds : 1.0;
+    sample_references = max<uint64_t>(1, sample_references);
+    sample_every = sample_base = sample_references;
+}
+
+void Metrics::start(const vector<JobTableEntry>& jobTable, ReplacementAlgorithm run_algorithm, int frames) {
+    if (prefix.empty() || active) return;
+    jobs = &jobTable;
+    algorithm = run_algorithm;
+    num_frames = frames;
+    page_size = SIM->page_size;
+    {
+        lock_guard<mutex> lock(shards_lock);
+        shards.clear();
+    }
+    generation++;
+    rss.clear();
+    sample_every = sample_base;
+    job_rss.assign(jobTable.size() <= MAX_JOB_SERIES ? jobTable.size() : 0, vector<int64_t>());
+    stopping = false;
+    active = true;
+    exporter = thread(&Metrics::exporterLoop, this);
+}
+
+// Stop recording and write the final files. Job threads must be done.
+void Metrics::stop() {
+    if (!active) return;
+    {
+        lock_guard<mutex> lock(exporter_lock);
+        stopping = true;
+    }
+    exporter_wake.notify_all();
+    exporter.join();
+    active = false;
+    sampleResident(SIM->access_clock);
+    if (exportFiles()) cout << "Metrics written to " << prefix << ".json and " << prefix << ".prom\n";
+}
+
+MetricShard& Metrics::threadShard() {
+    // A thread keeps its shard across runs; the generation tells it when start() dropped them
+    thread_local MetricShard* shard = nullptr;
+    thread_local uint64_t shard_generation = 0;
+    thread_local const Metrics* shard_metrics = nullptr;
+    if (!shard || shard_generation != generation || shard_metrics != this) {
+        lock_guard<mutex> lock(shards_lock);
+        shards.push_back(unique_ptr<MetricShard>(new MetricShard()));
+        shard = shards.back().get();
+        shard_generation = generation;
+        shard_metrics = this;
+    }
+    return *shard;
+}
+
+void Metrics::sampleResident(uint64_t now) {
+    int64_t total = 0;
+    lock_guard<mutex> lock(series_lock);
+    for (size_t j = 0; j < jobs->size(); ++j) {
+        int64_t resident = (*jobs)[j].counters.resident.load(memory_order_relaxed);
+        total += resident;
+        if (j < job_rss.size()) job_rss[j].push_back(resident);
+    }
+    rss.push_back(make_pair(now, total));
+    if (rss.size() >= MAX_RSS_SAMPLES) {
+        // Keep every other sample and sample half as often from now on
+        for (size_t i = 0; i < rss.size() / 2; ++i) rss[i] = rss[2 * i + 1];
+        rss.resize(rss.size() / 2);
+        for (auto& series : job_rss) {
+            for (size_t i = 0; i < series.size() / 2; ++i) series[i] = series[2 * i + 1];
+            series.resize(series.size() / 2);
+        }
+        sample_every *= 2;
+    }
+}
+
+void Metrics::exporterLoop() {
+    unique_lock<mutex> lock(exporter_lock);
+    while (!exporter_wake.wait_for(lock, chrono::duration<double>(interval), [this] { return stopping; })) {
+        lock.unlock();
+        exportFiles();
+        lock.lock();
+    }
+}
+
+// Write both files through a temporary name, so a reader never sees half a file
+bool Metrics::exportFiles() {
+    const pair<string, string> files[] = {{prefix + ".json", toJson()}, {prefix + ".prom", toPrometheus()}};
+    for (const auto& file : files) {
+        string temp = file.first + ".tmp";
+        {
+            ofstream out(temp, ios::trunc);
+            if (!out) {
+                cout << "Cannot write " << temp << "\n";
+                return false;
+            }
+            out << file.second;
+        }
+        remove(file.first.c_str());
+        if (rename(temp.c_str(), file.first.c_str()) != 0) return false;
+    }
+    return true;
+}
+
+// Sum the counters of all jobs
+PagingCounters totalCounters(const vector<JobTableEntry>& jobTable) {
+    PagingCounters total;
+    for (const auto& job : jobTable) {
+        total.hits += job.counters.hits;
+        total.faults += job.counters.faults;
+        total.evictions += job.counters.evictions;
+        total.dirty_evictions += job.counters.dirty_evictions;
+        total.resident += job.counters.resident;
+        total.prefetches += job.counters.prefetches;
+        total.prefetch_hits += job.counters.prefetch_hits;
+        total.prefetch_wasted += job.counters.prefetch_wasted;
+        total.pollution_faults += job.counters.pollution_faults;
+        total.clock_ns += job.counters.clock_ns;
+        total.stall_ns += job.counters.stall_ns;
+    }
+    return total;
+}
+
+// Merge one histogram across all shards
+HistogramSnapshot mergeShards(const vector<unique_ptr<MetricShard>>& shards, LatencyHistogram MetricShard::*histogram) {
+    HistogramSnapshot snapshot;
+    snapshot.counts.assign(LatencyHistogram::BUCKETS, 0);
+    for (const auto& shard : shards) ((*shard).*histogram).mergeInto(snapshot.counts, snapshot.sum, snapshot.max_value);
+    for (uint64_t c : snapshot.counts) snapshot.count += c;
+    return snapshot;
+}
+
+string histogramJson(const HistogramSnapshot& h) {
+    ostringstream out;
+    out << "{\"count\":" << h.count << ",\"sum\":" << h.sum << ",\"max\":" << h.max_value
+        << ",\"p50\":" << h.percentile(0.5) << ",\"p90\":" << h.percentile(0.9) << ",\"p99\":" << h.percentile(0.99)
+        << ",\"p999\":" << h.percentile(0.999) << ",\"buckets\":[";
+    bool first = true;
+    for (int b = 0; b < (int)h.counts.size(); ++b) {
+        if (h.counts[b] == 0) continue;
+        out << (first ? "" : ",") << "[" << LatencyHistogram::bucketLow(b) << "," << h.counts[b] << "]";
+        first = false;
+    }
+    out << "]}";
+    return out.str();
+}
+
+// Prometheus histogram with cumulative buckets at the upper end of every non-empty bucket
+string histogramPrometheus(const string& name, const string& help, const HistogramSnapshot& h) {
+    ostringstream out;
+    out << "# HELP " << name << " " << help << "\n# TYPE " << name << " histogram\n";
+    uint64_t cumulative = 0;
+    for (int b = 0; b < (int)h.counts.size(); ++b) {
+        if (h.counts[b] == 0) continue;
+        cumulative += h.counts[b];
+        out << name << "_bucket{le=\"" << LatencyHistogram::bucketLow(b + 1) - 1 << "\"} " << cumulative << "\n";
+    }
+    out << name << "_bucket{le=\"+Inf\"} " << h.count << "\n" << name << "_sum " << h.sum << "\n" << name << "_count " << h.count << "\n";
+    return out.str();
+}
+
+string Metrics::toJson() {
+    HistogramSnapshot faults, references;
+    {
+        lock_guard<mutex> lock(shards_lock);
+        faults = mergeShards(shards, &MetricShard::fault_service_ns);
+        references = mergeShards(shards, &MetricShard::reference_ns);
+    }
+    PagingCounters total = totalCounters(*jobs);
+    auto counters = [](const PagingCounters& c) {
+        return "\"hits\":" + to_string(c.hits.load()) + ",\"faults\":" + to_string(c.faults.load()) + ",\"evictions\":"
+             + to_string(c.evictions.load()) + ",\"dirty_evictions\":" + to_string(c.dirty_evictions.load())
+             + ",\"resident\":" + to_string(c.resident.load()) + ",\"prefetches\":" + to_string(c.prefetches.load())
+             + ",\"prefetch_hits\":" + to_string(c.prefetch_hits.load()) + ",\"prefetch_wasted\":" + to_string(c.prefetch_wasted.load())
+             + ",\"pollution_faults\":" + to_string(c.pollution_faults.load()) + ",\"stall_ns\":" + to_string(c.stall_ns.load());
+    };
+    ostringstream out;
+    out << "{\"algorithm\":\"" << algorithmName(algorithm) << "\",\"frames\":" << num_frames << ",\"page_size\":" << page_size
+        << ",\"references\":" << total.hits + total.faults << ",\"totals\":{" << counters(total) << "},\"jobs\":[";
+    for (size_t j = 0; j < jobs->size(); ++j) {
+        out << (j ? "," : "") << "{\"job\":" << (*jobs)[j].job_no << "," << counters((*jobs)[j].counters) << "}";
+    }
+    out << "],\"fault_service_ns\":" << histogramJson(faults) << ",\"reference_ns\":" << histogramJson(references);
+    lock_guard<mutex> lock(series_lock);
+    out << ",\"rss\":{\"time\":[";
+    for (size_t i = 0; i < rss.size(); ++i) out << (i ? "," : "") << rss[i].first;
+    out << "],\"total\":[";
+    for (size_t i = 0; i < rss.size(); ++i) out << (i ? "," : "") << rss[i].second;
+    out << "],\"jobs\":[";
+    for (size_t j = 0; j < job_rss.size(); ++j) {
+        out << (j ? "," : "") << "[";
+        for (size_t i = 0; i < job_rss[j].size(); ++i) out << (i ? "," : "") << job_rss[j][i];
+        out << "]";
+    }
+    out << "]}}\n";
+    return out.str();
+}
+
+string Metrics::toPrometheus() {
+    HistogramSnapshot faults, references;
+    {
+        lock_guard<mutex> lock(shards_lock);
+        faults = mergeShards(shards, &MetricShard::fault_service_ns);
+        references = mergeShards(shards, &MetricShard::reference_ns);
+    }
+    PagingCounters total = totalCounters(*jobs);
+    ostringstream out;
+    const pair<const char*, atomic<uint64_t> PagingCounters::*> counters[] = {
+        {"hits", &PagingCounters::hits}, {"faults", &PagingCounters::faults},
+        {"evictions", &PagingCounters::evictions}, {"dirty_evictions", &PagingCounters::dirty_evictions},
+        {"prefetches", &PagingCounters::prefetches}, {"prefetch_hits", &PagingCounters::prefetch_hits},
+        {"prefetch_wasted", &PagingCounters::prefetch_wasted}, {"pollution_faults", &PagingCounters::pollution_faults},
+        {"stall_ns", &PagingCounters::stall_ns}};
+    for (const auto& counter : counters) {
+        string name = string("paging_") + counter.first + "_total";
+        out << "# HELP " << name << " Page " << counter.first << " by job\n# TYPE " << name << " counter\n";
+        out << name << " " << (total.*counter.second).load() << "\n";
+        for (const auto& job : *jobs) out << name << "{job=\"" << job.job_no << "\"} " << (job.counters.*counter.second).load() << "\n";
+    }
+    out << "# HELP paging_resident_pages Pages in memory\n# TYPE paging_resident_pages gauge\n";
+    out << "paging_resident_pages " << total.resident << "\n";
+    for (const auto& job : *jobs) out << "paging_resident_pages{job=\"" << job.job_no << "\"} " << job.counters.resident << "\n";
+    out << "# HELP paging_frames Physical frames\n# TYPE paging_frames gauge\npaging_frames{algorithm=\"" << algorithmName(algorithm) << "\"} " << num_frames << "\n";
+    out << histogramPrometheus("paging_fault_service_ns", "Simulated fault service time in nanoseconds", faults);
+    out << histogramPrometheus("paging_reference_ns", "Wall-clock time per reference in nanoseconds", references);
+    return out.str();
+}
+
+bool parseLogLevel(const string& name, LogLevel& level) {
+    if (name == "silent") level = LogLevel::SILENT;
+    else if (name == "faults") level = LogLevel::FAULTS;
+    else if (name == "all") level = LogLevel::ALL;
+    else if (name == "snapshots") level = LogLevel::SNAPSHOTS;
+    else return false;
+    return true;
+}
+
+bool parseLogFormat(const string& name, LogFormat& format) {
+    if (name == "text") format = LogFormat::TEXT;
+    else if (name == "ndjson") format = LogFormat::NDJSON;
+    else if (name == "binary") format = LogFormat::BINARY;
+    else return false;
+    return true;
+}
+
+// Pack a page reference into the 8-byte on-disk record
+uint64_t encodeTraceRecord(uint64_t logical_addr, int job_no, bool is_write) {
+    uint64_t raw = (logical_addr & TRACE_ADDR_MASK) | ((uint64_t)(job_no & TRACE_JOB_MASK) << TRACE_JOB_SHIFT);
+    if (is_write) raw |= TRACE_WRITE_BIT;
+    return raw;
+}
+
+// Unpack an on-disk record
+TraceRecord decodeTraceRecord(uint64_t raw) {
+    TraceRecord record;
+    record.logical_addr = raw & TRACE_ADDR_MASK;
+    record.job_no = (int)((raw >> TRACE_JOB_SHIFT) & TRACE_JOB_MASK);
+    record.is_write = (raw & TRACE_WRITE_BIT) != 0;
+    return record;
+}
+
+// Records mapped (or buffered) at a time while streaming a trace: 64 MiB
+const uint64_t TRACE_WINDOW_RECORDS = 8ULL << 20;
+
+// Open a trace, validate its header and load the job table from the end of the file
+bool TraceReader::open(const string& path) {
+    close();
+
+    ifstream in(path, ios::binary);
+    if (!in) {
+        cout << "Cannot open trace " << path << "\n";
+        return false;
+    }
+    in.read((char*)&header, sizeof(header));
+    if (!in || memcmp(header.magic, TRACE_MAGIC, 4) != 0 || header.version != TRACE_VERSION) {
+        cout << path << " is not a version " << TRACE_VERSION << " trace file\n";
+        return false;
+    }
+
+    in.seekg(0, ios::end);
+    uint64_t file_size = (uint64_t)in.tellg();
+    uint64_t job_table_offset = sizeof(header) + header.num_records * sizeof(uint64_t);
+    if (file_size != job_table_offset + (uint64_t)header.num_jobs * sizeof(uint64_t)) {
+        cout << path << " is truncated or corrupt\n";
+        return false;
+    }
+    job_sizes.resize(header.num_jobs);
+    in.seekg(job_table_offset);
+    in.read((char*)job_sizes.data(), job_sizes.size() * sizeof(uint64_t));
+    in.close();
+
+    if (!stream.open(path, sizeof(header), header.num_records)) {
+        cout << "Cannot open trace " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool RecordStream::open(const string& path, uint64_t offset, uint64_t count) {
+    close();
+#ifdef _WIN32
+    file.open(path, ios::binary);
+    if (!file) return false;
+#else
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+#endif
+    data_offset = offset;
+    num_records = count;
+    position = 0;
+    window_first = 0;
+    window_count = 0;
+    return true;
+}
+
+void RecordStream::close() {
+#ifdef _WIN32
+    if (file.is_open()) file.close();
+    buffer.clear();
+#else
+    if (mapping) munmap(mapping, mapping_length);
+    mapping = nullptr;
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+#endif
+    records = nullptr;
+    window_count = 0;
+}
+
+// Make the window starting at first_record current, dropping the previous one
+bool RecordStream::mapWindow(uint64_t first_record) {
+    uint64_t count = min(TRACE_WINDOW_RECORDS, num_records - first_record);
+    uint64_t offset = data_offset + first_record * sizeof(uint64_t);
+#ifdef _WIN32
+    buffer.resize(count);
+    file.clear();
+    file.seekg(offset);
+    file.read((char*)buffer.data(), count * sizeof(uint64_t));
+    if (!file) return false;
+    records = buffer.data();
+#else
+    if (mapping) munmap(mapping, mapping_length);
+    // mmap offsets must be page aligned, so map from the page holding the first record
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t aligned = offset - offset % page;
+    mapping_skip = offset - aligned;
+    mapping_length = mapping_skip + count * sizeof(uint64_t);
+    mapping = mmap(nullptr, mapping_length, PROT_READ, MAP_PRIVATE, fd, (off_t)aligned);
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        return false;
+    }
+    madvise(mapping, mapping_length, MADV_SEQUENTIAL);
+    records = (const uint64_t*)((const char*)mapping + mapping_skip);
+#endif
+    window_first = first_record;
+    window_count = count;
+    return true;
+}
+
+// Hand out the next record; false once all records are consumed
+bool RecordStream::next(uint64_t& raw) {
+    if (position >= num_records) return false;
+    if (records == nullptr || position < window_first || position >= window_first + window_count) {
+        if (!mapWindow(position)) return false;
+    }
+    raw = records[position - window_first];
+    position++;
+    return true;
+}
+
+// Hand out the next record; false at the end of the trace
+bool TraceReader::next(TraceRecord& record) {
+    uint64_t raw;
+    if (!stream.next(raw)) return false;
+    record = decodeTraceRecord(raw);
+    return true;
+}
+
+// Identify the page a record touches across all jobs
+uint64_t tracePageKey(const TraceRecord& record, const PageGeometry& geometry) {
+    return ((uint64_t)record.job_no << TRACE_JOB_SHIFT) | geometry.pageOf(record.logical_addr);
+}
+
+// Build "<trace>.nextuse" with one backward pass over the trace. Blocks are read from the
+// end of the trace towards the start; only the current block and the last position of
+// each distinct page are held in memory, so long traces stay within bounded memory.
+bool buildNextUseIndex(const string& trace_path, int page_size) {
+    TraceReader reader;
+    if (!reader.open(trace_path)) return false;
+
+    string index_path = trace_path + ".nextuse";
+    ofstream out(index_path, ios::binary | ios::trunc);
+    if (!out) {
+        cout << "Cannot create " << index_path << "\n";
+        return false;
+    }
+    NextUseFileHeader header = {};
+    memcpy(header.magic, NEXT_USE_MAGIC, 4);
+    header.page_size = (uint32_t)page_size;
+    header.num_records = reader.numRecords();
+    out.write((const char*)&header, sizeof(header));
+
+    unordered_map<uint64_t, uint64_t> nextPosition;
+    vector<uint64_t> block, nextUse;
+    PageGeometry geometry(page_size);
+    uint64_t end = reader.numRecords();
+    while (end > 0) {
+        uint64_t start = end > TRACE_WINDOW_RECORDS ? end - TRACE_WINDOW_RECORDS : 0;
+        block.resize(end - start);
+        nextUse.resize(end - start);
+        reader.seek(start);
+        for (auto& raw : block) reader.nextRaw(raw);
+
+        for (uint64_t i = end; i-- > start;) {
+            uint64_t key = tracePageKey(decodeTraceRecord(block[i - start]), geometry);
+            auto it = nextPosition.find(key);
+            if (it == nextPosition.end()) {
+                nextUse[i - start] = NEVER_USED_AGAIN;
+                nextPosition.emplace(key, i);
+            } else {
+                nextUse[i - start] = it->second;
+                it->second = i;
+            }
+        }
+        out.seekp(sizeof(header) + start * sizeof(uint64_t));
+        out.write((const char*)nextUse.data(), nextUse.size() * sizeof(uint64_t));
+        end = start;
+    }
+    out.close();
+    if (out.fail()) return false;
+    cout << "Wrote next-use index " << index_path << " (" << reader.numRecords() << " references, "
+         << nextPosition.size() << " distinct pages)\n";
+    return true;
+}
+
+// Open the next-use index of a trace, building it first if it is missing or was built for
+// a different page size or trace length
+bool openNextUseIndex(const string& trace_path, int page_size, RecordStream& stream) {
+    TraceReader reader;
+    if (!reader.open(trace_path)) return false;
+    string index_path = trace_path + ".nextuse";
+
+    NextUseFileHeader header = {};
+    ifstream in(index_path, ios::binary);
+    if (in) in.read((char*)&header, sizeof(header));
+    bool current = in && memcmp(header.magic, NEXT_USE_MAGIC, 4) == 0 && header.page_size == (uint32_t)page_size
+                   && header.num_records == reader.numRecords();
+    in.close();
+    if (!current && !buildNextUseIndex(trace_path, page_size)) return false;
+
+    return stream.open(index_path, sizeof(NextUseFileHeader), reader.numRecords());
+}
+
+bool TraceWriter::open(const string& path) {
+    file.open(path, ios::binary | ios::trunc);
+    if (!file) {
+        cout << "Cannot create trace " << path << "\n";
+        return false;
+    }
+    // Header is rewritten with the real record count on close
+    TraceFileHeader header = {};
+    file.write((const char*)&header, sizeof(header));
+    buffer.reserve(1 << 16);
+    num_records = 0;
+    return true;
+}
+
+void TraceWriter::write(uint64_t logical_addr, int job_no, bool is_write) {
+    buffer.push_back(encodeTraceRecord(logical_addr, job_no, is_write));
+    if (buffer.size() == buffer.capacity()) {
+        file.write((const char*)buffer.data(), buffer.size() * sizeof(uint64_t));
+        buffer.clear();
+    }
+    num_records++;
+}
+
+bool TraceWriter::close(const vector<uint64_t>& job_sizes) {
+    file.write((const char*)buffer.data(), buffer.size() * sizeof(uint64_t));
+    buffer.clear();
+    file.write((const char*)job_sizes.data(), job_sizes.size() * sizeof(uint64_t));
+
+    TraceFileHeader header = {};
+    memcpy(header.magic, TRACE_MAGIC, 4);
+    header.version = TRACE_VERSION;
+    header.num_jobs = (uint32_t)job_sizes.size();
+    header.num_records = num_records;
+    file.seekp(0);
+    file.write((const char*)&header, sizeof(header));
+    file.close();
+    return !file.fail();
+}
+
+// Convert Valgrind lackey output (valgrind --tool=lackey --trace-mem=yes) into a binary trace.
+// Each input file becomes one job. Raw virtual addresses are sparse (code, heap and stack sit
+// far apart), so every distinct page is renumbered densely in first-touch order while the
+// offset within the page is kept; replacement only depends on page identity.
+bool importLackeyTrace(const vector<string>& inputs, const string& output, int page_size) {
+    TraceWriter writer;
+    if (!writer.open(output)) return false;
+    if ((int)inputs.size() > TRACE_MAX_JOBS) {
+        cout << "At most " << TRACE_MAX_JOBS << " jobs fit in a trace\n";
+        return false;
+    }
+
+    vector<uint64_t> job_sizes;
+    PageGeometry geometry(page_size);
+    for (int job_no = 0; job_no < (int)inputs.size(); ++job_no) {
+        ifstream in(inputs[job_no]);
+        if (!in) {
+            cout << "Cannot open " << inputs[job_no] << "\n";
+            return false;
+        }
+
+        unordered_map<uint64_t, uint64_t> densePages;
+        string line;
+        uint64_t skipped = 0, too_far = 0;
+        while (getline(in, line)) {
+            // Lines look like "I  0400d7d4,8", " L 1ffefffd08,8", " S ...", " M ..."
+            size_t pos = line.find_first_not_of(' ');
+            if (pos == string::npos || pos + 1 >= line.size()) continue;
+            char kind = line[pos];
+            if (kind != 'I' && kind != 'L' && kind != 'S' && kind != 'M') {
+                skipped++;
+                continue;
+            }
+            uint64_t addr = strtoull(line.c_str() + pos + 1, nullptr, 16);
+            uint64_t raw_page = geometry.pageOf(addr);
+            auto it = densePages.find(raw_page);
+            if (it == densePages.end()) it = densePages.emplace(raw_page, densePages.size()).first;
+
+            uint64_t logical_addr = it->second * page_size + geometry.offsetOf(addr);
+            if (logical_addr > TRACE_ADDR_MASK) {
+                too_far++;
+                continue;
+            }
+            writer.write(logical_addr, job_no, kind == 'S' || kind == 'M');
+        }
+        job_sizes.push_back(densePages.size() * (uint64_t)page_size);
+        cout << inputs[job_no] << ": " << densePages.size() << " distinct pages";
+        if (skipped > 0) cout << ", " << skipped << " non-trace lines skipped";
+        if (too_far > 0) cout << ", " << too_far << " references past " << TRACE_JOB_SHIFT << " address bits dropped";
+        cout << "\n";
+    }
+    return writer.close(job_sizes);
+}
+
+// Convert a plain text trace with one "<job> <address> [R|W]" reference per line into a
+// binary trace. Addresses may be decimal or 0x-prefixed hex; job sizes come from the
+// highest address each job touches.
+bool importPlainTrace(const string& input, const string& output) {
+    ifstream in(input);
+    if (!in) {
+        cout << "Cannot open " << input << "\n";
+        return false;
+    }
+    TraceWriter writer;
+    if (!writer.open(output)) return false;
+
+    vector<uint64_t> job_sizes;
+    string line;
+    int line_no = 0;
+    while (getline(in, line)) {
+        line_no++;
+        if (line.empty() || line[0] == '#') continue;
+
+        istringstream fields(line);
+        int job_no;
+        string addr_text, mode = "R";
+        if (!(fields >> job_no >> addr_text) || job_no < 0 || job_no >= TRACE_MAX_JOBS) {
+            cout << input << ":" << line_no << ": expected \"<job> <address> [R|W]\"\n";
+            return false;
+        }
+        fields >> mode;
+        uint64_t addr = strtoull(addr_text.c_str(), nullptr, 0);
+        // Records keep 47 address bits; a larger address would silently become another page
+        if (addr > TRACE_ADDR_MASK) {
+            cout << input << ":" << line_no << ": address " << addr_text << " does not fit in " << TRACE_JOB_SHIFT << " bits\n";
+            return false;
+        }
+
+        if (job_no >= (int)job_sizes.size()) job_sizes.resize(job_no + 1, 0);
+        job_sizes[job_no] = max(job_sizes[job_no], addr + 1);
+        writer.write(addr, job_no, mode == "W" || mode == "w");
+    }
+    return writer.close(job_sizes);
+}
+
+// Replay a binary trace through the same PMT/frame logic as the interactive simulation
+#ifdef __linux__
+void realMemoryFault(int sig, siginfo_t* info, void*) {
+    if (SIM->mmap_engine.handleFault(info->si_addr)) return;
+    // Not a page of ours: the retried access crashes the usual way
+    signal(sig, SIG_DFL);
+}
+
+struct sigaction previousSegvAction;
+#endif
+
+// Set up the arena, the reserved range, the store and the fault handler; false if any fails
+bool MmapEngine::start(int total_pages, int num_frames) {
+#ifdef __linux__
+    long system_page = sysconf(_SC_PAGESIZE);
+    if (SIM->page_size % system_page != 0) {
+        cout << "--real-memory maps whole pages: --page-size must be a multiple of " << system_page << "\n";
+        return false;
+    }
+    frames_bytes = (size_t)num_frames * SIM->page_size;
+    region_bytes = (size_t)max(total_pages, 1) * SIM->page_size;
+    frames_fd = memfd_create("frames", 0);
+    if (frames_fd < 0 || ftruncate(frames_fd, (off_t)frames_bytes) != 0) {
+        cout << "Cannot create the frame arena: " << strerror(errno) << "\n";
+        stop();
+        return false;
+    }
+    void* arena = mmap(nullptr, frames_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, frames_fd, 0);
+    void* reserved = mmap(nullptr, region_bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    frames = arena == MAP_FAILED ? nullptr : (uint8_t*)arena;
+    if (reserved != MAP_FAILED) region = (uint8_t*)reserved;
+    if (!frames || !region) {
+        cout << "Cannot map " << frames_bytes << " bytes of frames and " << region_bytes << " bytes of pages: " << strerror(errno) << "\n";
+        stop();
+        return false;
+    }
+    if (store_path.empty()) {
+        char name[] = "/tmp/paging-store-XXXXXX";
+        store_fd = mkstemp(name);
+        if (store_fd >= 0) unlink(name);
+    } else {
+        store_fd = open(store_path.c_str(), O_RDWR | O_CREAT, 0644);
+    }
+    // Sparse: pages never written back read as zeros
+    if (store_fd < 0 || ftruncate(store_fd, (off_t)region_bytes) != 0) {
+        cout << "Cannot open the page store " << (store_path.empty() ? "in /tmp" : store_path) << ": " << strerror(errno) << "\n";
+        stop();
+        return false;
+    }
+    struct sigaction action = {};
+    action.sa_sigaction = realMemoryFault;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previousSegvAction);
+    traps = mismatches = bytes_read = bytes_written = 0;
+    return true;
+#else
+    (void)total_pages;
+    (void)num_frames;
+    cout << "--real-memory needs Linux (memfd and SIGSEGV handling)\n";
+    return false;
+#endif
+}
+
+void MmapEngine::stop() {
+#ifdef __linux__
+    if (region) sigaction(SIGSEGV, &previousSegvAction, nullptr);
+    if (region) munmap(region, region_bytes);
+    if (frames) munmap(frames, frames_bytes);
+    if (frames_fd >= 0) close(frames_fd);
+    if (store_fd >= 0) close(store_fd);
+#endif
+    region = frames = nullptr;
+    frames_fd = store_fd = -1;
+}
+
+// Reference a byte through the MMU. Returns whether it trapped, like referencePage.
+bool MmapEngine::reference(Job& ref_job, uint64_t logical_addr, bool write, FrameTable& frameTable, MemoryMapTable& mmt, vector<JobTableEntry>& jobs, vector<PageTable>& pmts, ReplacementState& state, int* resolved_frame) {
+    job = &ref_job;
+    is_write = write;
+    resolved = resolved_frame;
+    pageFrames = &frameTable;
+    memoryMapTable = &mmt;
+    jobTable = &jobs;
+    pageMapTables = &pmts;
+    replacement = &state;
+    trapped = faulted = false;
+    int page_index = (int)(logical_addr / SIM->page_size);
+    volatile uint8_t* byte = region + (size_t)(jobs[ref_job.number].first_page_no + page_index) * SIM->page_size + logical_addr % SIM->page_size;
+    // The fences keep the compiler from moving the handler's inputs and outputs across the touch
+    atomic_signal_fence(memory_order_seq_cst);
+    if (write) *byte = (uint8_t)(*byte + 1);
+    else (void)*byte;
+    atomic_signal_fence(memory_order_seq_cst);
+    job = nullptr;
+    if (trapped) {
+        if (!faulted) mismatches++;
+        return true;
+    }
+    // The page was mapped; the policy still has to see the reference
+    if (referencePage(ref_job, page_index, write, frameTable, mmt, jobs, pmts, state, resolved_frame)) mismatches++;
+    return false;
+}
+
+// Called from the SIGSEGV handler. The fault is synchronous, raised by the touch in reference
+// while no lock is held, so running the fault path from the handler is safe here.
+bool MmapEngine::handleFault(void* address) {
+    uint8_t* byte = (uint8_t*)address;
+    if (!job || !region || byte < region || byte >= region + region_bytes) return false;
+    auto started = chrono::steady_clock::now();
+    int page_no = (int)((byte - region) / SIM->page_size);
+    int page_index = page_no - (*jobTable)[job->number].first_page_no;
+    faulted = referencePage(*job, page_index, is_write, *pageFrames, *memoryMapTable, *jobTable, *pageMapTables, *replacement, resolved);
+    trapped = true;
+    traps++;
+    service_ns.record((uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - started).count());
+    return true;
+}
+
+// Fill a frame from the store and map it at the page's address
+void MmapEngine::load(int page_no, int frame_no) {
+#ifdef __linux__
+    uint8_t* frame = frames + (size_t)frame_no * SIM->page_size;
+    ssize_t got = pread(store_fd, frame, SIM->page_size, (off_t)page_no * SIM->page_size);
+    if (got < SIM->page_size) memset(frame + max<ssize_t>(got, 0), 0, SIM->page_size - max<ssize_t>(got, 0));
+    bytes_read += SIM->page_size;
+    mmap(region + (size_t)page_no * SIM->page_size, SIM->page_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, frames_fd, (off_t)frame_no * SIM->page_size);
+#else
+    (void)page_no;
+    (void)frame_no;
+#endif
+}
+
+// Unmap the page, then write its frame back if it was modified
+void MmapEngine::evict(int page_no, int frame_no, bool dirty) {
+#ifdef __linux__
+    mmap(region + (size_t)page_no * SIM->page_size, SIM->page_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+    if (dirty && pwrite(store_fd, frames + (size_t)frame_no * SIM->page_size, SIM->page_size, (off_t)page_no * SIM->page_size) == SIM->page_size) {
+        bytes_written += SIM->page_size;
+    }
+#else
+    (void)page_no;
+    (void)frame_no;
+    (void)dirty;
+#endif
+}
+
+// Print the trapped faults against the policy's and their measured service time
+void MmapEngine::printStats(uint64_t policy_faults) const {
+    HistogramSnapshot h;
+    h.counts.assign(LatencyHistogram::BUCKETS, 0);
+    service_ns.mergeInto(h.counts, h.sum, h.max_value);
+    for (uint64_t c : h.counts) h.count += c;
+    cout << "Real memory: " << traps << " SIGSEGV faults for " << policy_faults << " policy faults";
+    if (mismatches > 0) cout << " (" << mismatches << " references disagreed)";
+    cout << ", " << bytes_read / 1024 << " KB read from the store, " << bytes_written / 1024 << " KB written back\n";
+    if (h.count > 0) {
+        cout << "  fault service (wall clock): mean " << h.sum / h.count / 1000.0 << " us, p50 " << h.percentile(0.5) / 1000.0
+             << " us, p99 " << h.percentile(0.99) / 1000.0 << " us, max " << h.max_value / 1000.0 << " us\n";
+    }
+}
+
+// Counts of one replay
+struct ReplayTotals {
+    uint64_t references = 0, faults = 0, invalid = 0;
+};
+
+// The replay loop: every record of the trace through referencePage, or through the MMU when
+// replaying on real memory. Geometry splits addresses into page and offset.
+template <class Geometry>
+void replayRecords(const Geometry& geometry, TraceReader& reader, RecordStream& nextUses, vector<Job>& jobs, FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementState& replacement, ReplayTotals& totals) {
+    bool opt = replacement.algorithm == ReplacementAlgorithm::OPT;
+    TraceRecord record;
+    while (reader.next(record)) {
+        if (opt) nextUses.next(replacement.opt.current_next_use);
+        if (record.job_no >= (int)jobs.size()) {
+            totals.invalid++;
+            continue;
+        }
+        Job& job = jobs[record.job_no];
+        uint64_t page_index = geometry.pageOf(record.logical_addr);
+        if (page_index >= (uint64_t)job.num_pages) {
+            totals.invalid++;
+            continue;
+        }
+        totals.references++;
+        int frame_no = -1;
+        bool faulted = SIM->mmap_engine.active()
+            ? SIM->mmap_engine.reference(job, record.logical_addr, record.is_write, pageFrames, memoryMapTable, jobTable, pageMapTables, replacement, &frame_no)
+            : referencePage(job, (int)page_index, record.is_write, pageFrames, memoryMapTable, jobTable, pageMapTables, replacement, &frame_no);
+        if (faulted) totals.faults++;
+        if (SIM->event_log.logs(LogLevel::ALL)) SIM->event_log.emit(LogEventType::RESOLVE, SIM->access_clock, job.number, (int)page_index, frame_no, record.logical_addr);
+    }
+}
+
+int replayTrace(const string& path, ReplacementAlgorithm algorithm) {
+    TraceReader reader;
+    if (!reader.open(path)) return 1;
+
+    vector<Job> jobs;
+    for (int i = 0; i < (int)reader.jobSizes().size(); ++i) {
+        Job job;
+        job.number = i;
+        job.size = reader.jobSizes()[i];
+        jobs.push_back(job);
+    }
+
+    int num_page_frames = ceil((float)SIM->total_memory / SIM->page_size);
+    FrameTable pageFrames;
+    vector<JobTableEntry> jobTable(jobs.size());
+    MemoryMapTable memoryMapTable;
+    vector<PageTable> pageMapTables;
+    initPageFrames(num_page_frames, pageFrames, memoryMapTable);
+    moveJobsToPages(jobs, jobTable, pageMapTables);
+    ReplacementState replacement;
+    initReplacementState(replacement, algorithm, num_page_frames);
+    initLocalAllocation(replacement, (int)jobs.size(), 0);
+    initPrefetch(replacement, (int)jobs.size());
+    initHugePages(replacement, jobs, num_page_frames);
+    SIM->tlb.flush();
+    SIM->swap.reset(num_page_frames);
+    if (SIM->mmap_engine.requestedRun()) {
+        int total_pages = jobs.empty() ? 0 : jobTable.back().first_page_no + jobs.back().num_pages;
+        if (!SIM->mmap_engine.start(total_pages, num_page_frames)) return 1;
+    }
+
+    cout << "Replaying " << reader.numRecords() << " references from " << jobs.size() << " jobs using "
+         << algorithmName(algorithm) << " with " << num_page_frames << " frames of " << SIM->page_size << " bytes\n";
+
+    RecordStream nextUses;
+    if (algorithm == ReplacementAlgorithm::OPT && !openNextUseIndex(path, SIM->page_size, nextUses)) return 1;
+
+    ReplayTotals totals;
+    SIM->event_log.start();
+    SIM->metrics.start(jobTable, algorithm, num_page_frames);
+    auto start = chrono::steady_clock::now();
+    // Specialize the loop on the common page sizes so their translation is a constant shift
+    switch (SIM->page_size) {
+    case (int)Page4K::SIZE:
+        replayRecords(Page4K(), reader, nextUses, jobs, pageFrames, memoryMapTable, jobTable, pageMapTables, replacement, totals);
+        break;
+    case (int)Page64K::SIZE:
+        replayRecords(Page64K(), reader, nextUses, jobs, pageFrames, memoryMapTable, jobTable, pageMapTables, replacement, totals);
+        break;
+    case (int)Page2M::SIZE:
+        replayRecords(Page2M(), reader, nextUses, jobs, pageFrames, memoryMapTable, jobTable, pageMapTables, replacement, totals);
+        break;
+    default:
+        replayRecords(PageGeometry(SIM->page_size), reader, nextUses, jobs, pageFrames, memoryMapTable, jobTable, pageMapTables, replacement, totals);
+        break;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    SIM->swap.flush(jobTable);
+    SIM->event_log.stop();
+    SIM->metrics.stop();
+
+    uint64_t references = totals.references, faults = totals.faults;
+    PagingCounters total = totalCounters(jobTable);
+    cout << "References: " << references << "\n";
+    cout << "Page faults: " << faults;
+    if (references > 0) cout << " (" << 100.0 * faults / references << "%)";
+    cout << "\n";
+    cout << "Evictions: " << total.evictions << " (dirty " << total.dirty_evictions << ")\n";
+    if (totals.invalid > 0) cout << "Out-of-range references skipped: " << totals.invalid << "\n";
+    printReplacementStats(replacement);
+    printPrefetchStats(jobTable);
+    printHugePageStats(jobs, replacement);
+    SIM->swap.printStats(jobTable);
+    if (SIM->mmap_engine.active()) {
+        SIM->mmap_engine.printStats(faults);
+        SIM->mmap_engine.stop();
+    }
+    SIM->tlb.printStats();
+    printPageTableStats(jobTable, pageMapTables);
+    cout << "Elapsed: " << seconds << " s";
+    if (seconds > 0) cout << " (" << (uint64_t)(references / seconds) << " references/s)";
+    cout << endl;
+    return 0;
+}
+
+// Fenwick (binary indexed) tree of counts over positions 1 .. size
+class FenwickTree {
+public:
+    void reset(int size) { tree.assign(size + 1, 0); }
+    int size() const { return (int)tree.size() - 1; }
+    void add(int position, int delta) {
+        for (; position < (int)tree.size(); position += position & -position) tree[position] += delta;
+    }
+    // Sum of positions 1 .. position
+    int prefix(int position) const {
+        int sum = 0;
+        for (; position > 0; position -= position & -position) sum += tree[position];
+        return sum;
+    }
+
+private:
+    vector<int> tree;
+};
+
+// LRU stack distances in O(log n) per reference (Mattson et al.). Every page is marked in a
+// Fenwick tree at the time slot of its last reference, so the pages referenced since then
+// are the marks after that slot. When the slots run out, the live pages are renumbered in
+// order, so the tree only needs about twice as many slots as there are distinct pages.
+class LruStackDistance {
+public:
+    LruStackDistance() { marks.reset(1 << 16); }
+
+    // Depth of the page in the LRU stack before this reference, 0 if it was never referenced
+    uint64_t reference(uint64_t key) {
+        if (next_slot > marks.size()) compact();
+        uint64_t depth = 0;
+        auto it = last_slot.find(key);
+        if (it == last_slot.end()) {
+            it = last_slot.emplace(key, 0).first;
+        } else {
+            depth = (uint64_t)(last_slot.size() - marks.prefix(it->second)) + 1;
+            marks.add(it->second, -1);
+        }
+        it->second = next_slot++;
+        marks.add(it->second, 1);
+        return depth;
+    }
+
+    uint64_t distinctPages() const { return last_slot.size(); }
+
+private:
+    void compact() {
+        vector<pair<int, uint64_t>> live;
+        live.reserve(last_slot.size());
+        for (const auto& entry : last_slot) live.push_back(make_pair(entry.second, entry.first));
+        sort(live.begin(), live.end());
+        marks.reset(max(marks.size(), 2 * (int)live.size()));
+        next_slot = 1;
+        for (const auto& page : live) {
+            last_slot[page.second] = next_slot;
+            marks.add(next_slot++, 1);
+        }
+    }
+
+    FenwickTree marks;
+    unordered_map<uint64_t, int> last_slot;
+    int next_slot = 1;
+};
+
+// OPT stack distances with Mattson's priority stack: the stack holds pages by how soon they
+// are used again, and position k of the top max_depth is what OPT keeps in k frames. A
+// reference moves its page to the top and pushes the displaced page down, and at every level
+// the page used sooner stays. O(depth) per reference, so the stack is capped at the largest
+// memory of interest; pages below the cap fault in every memory size that is analysed.
+class OptStackDistance {
+public:
+    explicit OptStackDistance(int max_depth) : max_depth(max_depth) {}
+
+    // Depth of the page before this reference (0 if not in the stack); next_use is the
+    // position of its next reference
+    uint64_t reference(uint64_t key, uint64_t next_use) {
+        if (!keys.empty() && keys[0] == key) {
+            uses[0] = next_use;
+            return 1;
+        }
+        uint64_t carry_key = key, carry_use = next_use;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (keys[i] == key) {
+                keys[i] = carry_key;
+                uses[i] = carry_use;
+                return i + 1;
+            }
+            if (i == 0 || carry_use < uses[i]) {
+                swap(carry_key, keys[i]);
+                swap(carry_use, uses[i]);
+            }
+        }
+        if ((int)keys.size() < max_depth) {
+            keys.push_back(carry_key);
+            uses.push_back(carry_use);
+        }
+        return 0;
+    }
+
+private:
+    int max_depth;
+    vector<uint64_t> keys, uses;
+};
+
+// Faults for every memory size from one histogram of stack depths: a reference faults in
+// memories smaller than its depth, and a first reference (depth 0) faults in all of them
+vector<uint64_t> faultCurve(const vector<uint64_t>& depth_counts, uint64_t cold, int max_frames) {
+    vector<uint64_t> faults(max_frames + 1, 0);
+    uint64_t deeper = cold;
+    for (uint64_t d = depth_counts.size(); d-- > (uint64_t)max_frames + 1;) deeper += depth_counts[d];
+    for (int frames = max_frames; frames >= 1; --frames) {
+        faults[frames] = deeper;
+        if ((size_t)frames < depth_counts.size()) deeper += depth_counts[frames];
+    }
+    return faults;
+}
+
+// --stack-distance: LRU and OPT fault counts for every memory size up to max_frames in one pass
+// over the trace each, with the job and page model of --replay
+int analyzeStackDistances(const string& path, int max_frames, const string& curve_path) {
+    TraceReader reader;
+    if (!reader.open(path)) return 1;
+    // Pages beyond the end of a job are skipped, as in replay
+    vector<uint64_t> job_pages;
+    uint64_t pages_so_far = 0;
+    for (uint64_t size : reader.jobSizes()) {
+        uint64_t num_pages = max<uint64_t>(1, (size + SIM->page_size - 1) / SIM->page_size);
+        num_pages = min<uint64_t>(num_pages, INT32_MAX - pages_so_far);
+        pages_so_far += num_pages;
+        job_pages.push_back(num_pages);
+    }
+
+    int memory_frames = (int)ceil((float)SIM->total_memory / SIM->page_size);
+    cout << "Stack distance analysis of " << reader.numRecords() << " references with pages of " << SIM->page_size << " bytes\n";
+    auto start = chrono::steady_clock::now();
+    PageGeometry geometry(SIM->page_size);
+    LruStackDistance lru;
+    vector<uint64_t> lruDepths;
+    uint64_t references = 0, lruCold = 0;
+    TraceRecord record;
+    while (reader.next(record)) {
+        if (record.job_no >= (int)job_pages.size() || geometry.pageOf(record.logical_addr) >= job_pages[record.job_no]) continue;
+        references++;
+        uint64_t depth = lru.reference(tracePageKey(record, geometry));
+        if (depth == 0) {
+            lruCold++;
+            continue;
+        }
+        if (depth >= lruDepths.size()) lruDepths.resize(depth + 1, 0);
+        lruDepths[depth]++;
+    }
+    if (max_frames <= 0) max_frames = (int)min<uint64_t>(lru.distinctPages(), INT32_MAX - 1);
+    max_frames = max(max_frames, 1);
+
+    // OPT needs the next-use index, which follows every record including skipped ones
+    RecordStream nextUses;
+    if (!openNextUseIndex(path, SIM->page_size, nextUses)) return 1;
+    reader.seek(0);
+    OptStackDistance opt(max_frames);
+    vector<uint64_t> optDepths(max_frames + 1, 0);
+    uint64_t optCold = 0, next_use = 0;
+    while (reader.next(record)) {
+        nextUses.next(next_use);
+        if (record.job_no >= (int)job_pages.size() || geometry.pageOf(record.logical_addr) >= job_pages[record.job_no]) continue;
+        uint64_t depth = opt.reference(tracePageKey(record, geometry), next_use);
+        if (depth == 0) optCold++;
+        else optDepths[depth]++;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<uint64_t> lruFaults = faultCurve(lruDepths, lruCold, max_frames);
+    vector<uint64_t> optFaults = faultCurve(optDepths, optCold, max_frames);
+    cout << "References: " << references << ", distinct pages: " << lru.distinctPages() << "\n";
+    cout << setw(10) << "frames" << setw(14) << "LRU faults" << setw(14) << "OPT faults" << "\n";
+    auto printRow = [&](int frames) {
+        cout << setw(10) << frames << setw(14) << lruFaults[frames] << setw(14) << optFaults[frames]
+             << (frames == memory_frames ? "   <- --memory" : "") << "\n";
+    };
+    bool printedMemory = false;
+    for (int frames = 1; frames <= max_frames; frames = frames > max_frames / 2 && frames < max_frames ? max_frames : frames * 2) {
+        if (!printedMemory && memory_frames < frames && memory_frames <= max_frames) {
+            printRow(memory_frames);
+            printedMemory = true;
+        }
+        printRow(frames);
+        if (frames == memory_frames) printedMemory = true;
+    }
+    if (!printedMemory && memory_frames <= max_frames) printRow(memory_frames);
+
+    if (!curve_path.empty()) {
+        ofstream out(curve_path, ios::trunc);
+        if (!out) {
+            cout << "Cannot write " << curve_path << "\n";
+            return 1;
+        }
+        out << "frames,lru_faults,opt_faults\n";
+        for (int frames = 1; frames <= max_frames; ++frames) out << frames << "," << lruFaults[frames] << "," << optFaults[frames] << "\n";
+        cout << "Fault curves written to " << curve_path << "\n";
+    }
+    cout << "Elapsed: " << seconds << " s" << endl;
+    return 0;
+}
+
+Xoshiro256::Xoshiro256(uint64_t seed) {
+    for (auto& word : state) {
+        uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        word = z ^ (z >> 31);
+    }
+}
+
+uint64_t Xoshiro256::next() {
+    auto rotl = [](uint64_t x, int k) { return (x << k) | (x >> (64 - k)); };
+    uint64_t result = rotl(state[1] * 5, 7) * 9;
+    uint64_t t = state[1] << 17;
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= t;
+    state[3] = rotl(state[3], 45);
+    return result;
+}
+
+// The top 53 bits make a double; scaling it keeps the bias below 2^-53 for any page count
+double Xoshiro256::unit() {
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+uint64_t Xoshiro256::below(uint64_t bound) {
+    return min(bound - 1, (uint64_t)(unit() * bound));
+}
+
+WorkloadGenerator::WorkloadGenerator(const WorkloadSettings& workload, int pages, uint64_t stream)
+    : settings(workload), random(workload.seed * 0x9E3779B97F4A7C15ULL + stream), num_pages(max(1, pages)) {
+    window = settings.window > 0 ? min(settings.window, num_pages) : max(1, num_pages / 4);
+    if (settings.model == WorkloadModel::ZIPF) {
+        // Gray et al., "Quickly generating billion-record synthetic databases": one pass
+        // over the pages for zeta(n), then each draw costs a pow
+        double theta = settings.zipf_theta;
+        for (int i = 1; i <= num_pages; ++i) zeta_n += 1.0 / pow((double)i, theta);
+        half_pow_theta = pow(0.5, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - pow(2.0 / num_pages, 1.0 - theta)) / (1.0 - (1.0 + half_pow_theta) / zeta_n);
+    }
+    if (settings.model == WorkloadModel::PHASE) base = (int)random.below(num_pages - window + 1);
+}
+
+int WorkloadGenerator::nextPage() {
+    uint64_t n = count++;
+    switch (settings.model) {
+    case WorkloadModel::ZIPF: {
+        double u = random.unit(), uz = u * zeta_n;
+        if (uz < 1.0 || num_pages == 1) return 0;
+        if (uz < 1.0 + half_pow_theta) return 1;
+        return min(num_pages - 1, (int)(num_pages * pow(eta * u - eta + 1.0, alpha)));
+    }
+    case WorkloadModel::SEQUENTIAL:
+        return (int)(n % num_pages);
+    case WorkloadModel::LOOP:
+        return (int)(n % window);
+    case WorkloadModel::STRIDE: {
+        int page = position;
+        position += settings.stride;
+        if (position >= num_pages) {
+            lap = (lap + 1) % min(settings.stride, num_pages);
+            position = lap;
+        }
+        return page;
+    }
+    case WorkloadModel::HOT_COLD: {
+        int hot = max(1, (int)(num_pages * settings.hot_fraction));
+        return random.unit() < settings.hot_probability ? (int)random.below(hot) : (int)random.below(num_pages);
+    }
+    case WorkloadModel::PHASE:
+        if (n > 0 && n % settings.phase_length == 0) base = (int)random.below(num_pages - window + 1);
+        return base + (int)random.below(window);
+    default:
+        return (int)random.below(num_pages);
+    }
+}
+
+const pair<const char*, WorkloadModel> WORKLOAD_MODEL_NAMES[] = {
+    {"uniform", WorkloadModel::UNIFORM}, {"zipf", WorkloadModel::ZIPF}, {"sequential", WorkloadModel::SEQUENTIAL},
+    {"loop", WorkloadModel::LOOP}, {"stride", WorkloadModel::STRIDE}, {"hotcold", WorkloadModel::HOT_COLD},
+    {"phase", WorkloadModel::PHASE}};
+
+bool parseWorkloadModel(const string& name, WorkloadModel& model) {
+    for (const auto& entry : WORKLOAD_MODEL_NAMES) {
+        if (name == entry.first) {
+            model = entry.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* workloadModelName(WorkloadModel model) {
+    for (const auto& entry : WORKLOAD_MODEL_NAMES) {
+        if (model == entry.second) return entry.first;
+    }
+    return "?";
+}
+
+// Split "a,b,c" and parse every item; false if one doesn't parse
+template <typename T>
+bool parseList(const string& text, vector<T>& values, function<bool(const string&, T&)> parse) {
+    values.clear();
+    stringstream in(text);
+    string item;
+    while (getline(in, item, ',')) {
+        T value;
+        if (!parse(item, value)) return false;
+        values.push_back(value);
+    }
+    return !values.empty();
+}
+
+bool parsePositive(const string& text, int& value) {
+    value = atoi(text.c_str());
+    return value > 0;
+}
+
+// The references of jobs of the given sizes under the workload settings, passed to emit as
+// (job, logical address, write). Jobs take turns at random, drawn from the seed as well, until
+// each has made its references.
+void generateWorkload(const vector<uint64_t>& job_sizes, const function<void(int, uint64_t, bool)>& emit) {
+    vector<WorkloadGenerator> generators;
+    vector<uint64_t> remaining;
+    vector<int> running;
+    generators.reserve(job_sizes.size());
+    for (int j = 0; j < (int)job_sizes.size(); ++j) {
+        int num_pages = (int)pagesFor(job_sizes[j], SIM->page_size);
+        generators.emplace_back(SIM->workload, num_pages, j);
+        remaining.push_back(job_sizes[j] == 0 ? 0 : SIM->workload.references > 0 ? SIM->workload.references : num_pages);
+        if (remaining.back() > 0) running.push_back(j);
+    }
+    Xoshiro256 turns(SIM->workload.seed);
+    while (!running.empty()) {
+        int slot = (int)turns.below(running.size());
+        int job_no = running[slot];
+        WorkloadGenerator& generator = generators[job_no];
+        uint64_t page = generator.nextPage();
+        uint64_t content = min<uint64_t>(SIM->page_size, job_sizes[job_no] - page * SIM->page_size);
+        uint64_t logical_addr = page * SIM->page_size + generator.rng().below(content);
+        emit(job_no, logical_addr, generator.nextIsWrite());
+        if (--remaining[job_no] == 0) {
+            running[slot] = running.back();
+            running.pop_back();
+        }
+    }
+}
+
+// --generate-trace: write the references of jobs of the given sizes under the workload
+// settings as a trace
+bool generateTrace(const string& output, const vector<uint64_t>& job_sizes) {
+    if (job_sizes.empty() || (int)job_sizes.size() > TRACE_MAX_JOBS) {
+        cout << "--generate-trace needs 1 to " << TRACE_MAX_JOBS << " job sizes\n";
+        return false;
+    }
+    TraceWriter writer;
+    if (!writer.open(output)) return false;
+    generateWorkload(job_sizes, [&](int job_no, uint64_t logical_addr, bool is_write) { writer.write(logical_addr, job_no, is_write); });
+    if (!writer.close(job_sizes)) return false;
+    cout << "Wrote a trace of " << job_sizes.size() << " jobs to " << output << "\n";
+    return true;
+}
+
+WorkStealingPool::WorkStealingPool(int num_threads) {
+    for (int t = 0; t < max(1, num_threads); ++t) queues.push_back(unique_ptr<TaskQueue>(new TaskQueue()));
+}
+
+// Deal the tasks out round robin; stealing evens out what the deal gets wrong
+void WorkStealingPool::submit(function<void()> task) {
+    queues[submitted++ % queues.size()]->tasks.push_back(move(task));
+}
+
+bool WorkStealingPool::take(int self, function<void()>& task) {
+    for (size_t i = 0; i < queues.size(); ++i) {
+        TaskQueue& queue = *queues[(self + i) % queues.size()];
+        lock_guard<mutex> lock(queue.lock);
+        if (queue.tasks.empty()) continue;
+        if (i == 0) {
+            task = move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+// Tasks never submit tasks, so a thread that finds every deque empty is done
+void WorkStealingPool::run() {
+    vector<thread> threads;
+    for (int t = 0; t < (int)queues.size(); ++t) {
+        threads.push_back(thread([this, t]() {
+            function<void()> task;
+            while (take(t, task)) task();
+        }));
+    }
+    for (auto& t : threads) t.join();
+}
+
+// Simulate one grid point in a context of its own, derived from base. The references come from
+// the point's workload, as --generate-trace would write them, and run in order on the calling
+// thread the way --replay runs a trace.
+void runSweepPoint(SweepPoint& point, const SimulatorContext& base, const vector<uint64_t>& job_sizes) {
+    unique_ptr<SimulatorContext> context(new SimulatorContext());
+    static_cast<SimulatorSettings&>(*context) = base;
+    context->page_size = point.page_size;
+    context->total_memory = (int)((int64_t)point.frames * point.page_size);
+    // A huge page keeps its size in bytes; runSweep checked that it divides into this page size
+    uint64_t huge_page_bytes = (uint64_t)base.huge_page_pages * base.page_size;
+    context->huge_page_pages = (int)(huge_page_bytes / point.page_size);
+    context->workload.model = point.workload;
+    context->tlb.configureLike(base.tlb);
+    context->swap.configureLike(base.swap);
+    context->event_log.configure(LogLevel::SILENT, LogFormat::TEXT, "");
+    SimulatorContext* previous = SIM;
+    SIM = context.get();
+
+    vector<Job> jobs;
+    for (int i = 0; i < (int)job_sizes.size(); ++i) {
+        Job job;
+        job.number = i;
+        job.size = job_sizes[i];
+        jobs.push_back(job);
+    }
+    vector<TraceRecord> records;
+    generateWorkload(job_sizes, [&](int job_no, uint64_t logical_addr, bool is_write) {
+        records.push_back({logical_addr, job_no, is_write});
+    });
+    PageGeometry geometry(point.page_size);
+    vector<uint64_t> next_use;
+    if (point.algorithm == ReplacementAlgorithm::OPT) {
+        next_use.resize(records.size());
+        unordered_map<uint64_t, uint64_t> next_position;
+        for (uint64_t i = records.size(); i-- > 0;) {
+            uint64_t key = tracePageKey(records[i], geometry);
+            auto it = next_position.find(key);
+            next_use[i] = it == next_position.end() ? NEVER_USED_AGAIN : it->second;
+            next_position[key] = i;
+        }
+    }
+
+    FrameTable pageFrames;
+    vector<JobTableEntry> jobTable(jobs.size());
+    MemoryMapTable memoryMapTable;
+    vector<PageTable> pageMapTables;
+    initPageFrames(point.frames, pageFrames, memoryMapTable);
+    moveJobsToPages(jobs, jobTable, pageMapTables);
+    ReplacementState replacement;
+    initReplacementState(replacement, point.algorithm, point.frames);
+    initLocalAllocation(replacement, (int)jobs.size(), 0);
+    initPrefetch(replacement, (int)jobs.size());
+    initHugePages(replacement, jobs, point.frames);
+    SIM->tlb.flush();
+    SIM->swap.reset(point.frames);
+
+    auto start = chrono::steady_clock::now();
+    for (uint64_t i = 0; i < records.size(); ++i) {
+        if (!next_use.empty()) replacement.opt.current_next_use = next_use[i];
+        const TraceRecord& record = records[i];
+        if (referencePage(jobs[record.job_no], (int)geometry.pageOf(record.logical_addr), record.is_write, pageFrames, memoryMapTable, jobTable, pageMapTables, replacement)) point.faults++;
+    }
+    point.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    SIM->swap.flush(jobTable);
+
+    PagingCounters total = totalCounters(jobTable);
+    point.references = records.size();
+    point.evictions = total.evictions;
+    point.dirty_evictions = total.dirty_evictions;
+    point.prefetches = total.prefetches;
+    point.tlb_hits = SIM->tlb.hits;
+    point.tlb_misses = SIM->tlb.misses;
+    point.stall_ns = total.stall_ns;
+    for (const auto& job : jobTable) point.makespan_ns = max(point.makespan_ns, job.counters.clock_ns.load());
+    SIM = previous;
+}
+
+// --sweep: simulate every combination of the given algorithms, frame counts, page sizes and
+// workloads on a work-stealing pool, each in a context of its own, and write one CSV row per
+// combination in grid order
+int runSweep(const vector<uint64_t>& job_sizes, const vector<ReplacementAlgorithm>& algorithms, const vector<int>& frame_counts,
+             const vector<int>& page_sizes, const vector<WorkloadModel>& workloads, int num_threads, const string& csv_path) {
+    // Memory sizes are ints, and every page size must split a huge page into a power of two
+    uint64_t huge_page_bytes = (uint64_t)SIM->huge_page_pages * SIM->page_size;
+    for (int page_size : page_sizes) {
+        for (int frames : frame_counts) {
+            if ((int64_t)frames * page_size > INT32_MAX) {
+                cout << frames << " frames of " << page_size << " bytes exceed the largest memory of " << INT32_MAX << " bytes\n";
+                return 1;
+            }
+        }
+        uint64_t ratio = huge_page_bytes / page_size;
+        if (huge_page_bytes > 0 && (huge_page_bytes % page_size != 0 || ratio < 2 || (ratio & (ratio - 1)) != 0)) {
+            cout << "A huge page of " << huge_page_bytes << " bytes is not a power-of-two multiple of page size " << page_size << ", at least twice it\n";
+            return 1;
+        }
+    }
+
+    vector<SweepPoint> points;
+    for (ReplacementAlgorithm algorithm : algorithms) {
+        for (WorkloadModel workload : workloads) {
+            for (int page_size : page_sizes) {
+                for (int frames : frame_counts) {
+                    SweepPoint point;
+                    point.algorithm = algorithm;
+                    point.workload = workload;
+                    point.frames = frames;
+                    point.page_size = page_size;
+                    points.push_back(point);
+                }
+            }
+        }
+    }
+    ofstream file;
+    if (!csv_path.empty()) {
+        file.open(csv_path, ios::trunc);
+        if (!file) {
+            cout << "Cannot write " << csv_path << "\n";
+            return 1;
+        }
+    }
+    cout << "Sweep: " << points.size() << " simulations of " << job_sizes.size() << " jobs on " << num_threads << " threads\n";
+
+    const SimulatorContext& base = *SIM;
+    WorkStealingPool pool(num_threads);
+    for (auto& point : points) {
+        pool.submit([&point, &base, &job_sizes]() { runSweepPoint(point, base, job_sizes); });
+    }
+    auto start = chrono::steady_clock::now();
+    pool.run();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    ostream& out = csv_path.empty() ? cout : file;
+    out << "algorithm,workload,frames,page_size,references,faults,fault_ratio,evictions,dirty_evictions,prefetches,"
+           "tlb_hits,tlb_misses,makespan_ns,stall_ns,seconds\n";
+    for (const auto& point : points) {
+        out << algorithmName(point.algorithm) << "," << workloadModelName(point.workload) << "," << point.frames << "," << point.page_size << ","
+            << point.references << "," << point.faults << "," << (point.references > 0 ? (double)point.faults / point.references : 0) << ","
+            << point.evictions << "," << point.dirty_evictions << "," << point.prefetches << "," << point.tlb_hits << "," << point.tlb_misses << ","
+            << point.makespan_ns << "," << point.stall_ns << "," << point.seconds << "\n";
+    }
+    if (!csv_path.empty()) cout << "Results written to " << csv_path << "\n";
+    cout << "Elapsed: " << seconds << " s" << endl;
+    return 0;
+}
+
+// Concurrency stress test and scaling benchmark.
+// Each thread owns STRESS_JOBS_PER_THREAD jobs and sends most of its references to a hot tenth
+// of their pages. One reference in STRESS_FOREIGN_ONE_IN goes to another thread's job, so
+// several threads fault on the same page at once and the loading handshake gets exercised.
+const int STRESS_JOBS_PER_THREAD = 4;
+const int STRESS_PAGES_PER_JOB = 512;
+const int STRESS_FOREIGN_ONE_IN = 16;
+
+// Run the stress workload on num_threads threads and return the wall time in seconds.
+// With check set, validate every paging invariant afterwards and return -1 on a violation.
+// num_page_frames 0 gives memory for a quarter of all pages.
+double runStressWorkload(int num_threads, uint64_t references_per_thread, ReplacementAlgorithm algorithm, bool check, int num_page_frames) {
+    vector<Job> jobs;
+    int num_jobs = num_threads * STRESS_JOBS_PER_THREAD;
+    for (int i = 0; i < num_jobs; ++i) {
+        Job job;
+        job.number = i;
+        job.size = STRESS_PAGES_PER_JOB * SIM->page_size;
+        jobs.push_back(job);
+    }
+    // Memory holds a quarter of all pages, so every thread keeps faulting and evicting
+    if (num_page_frames <= 0) num_page_frames = max(1, num_jobs * STRESS_PAGES_PER_JOB / 4);
+    FrameTable pageFrames;
+    vector<JobTableEntry> jobTable(jobs.size());
+    MemoryMapTable memoryMapTable;
+    vector<PageTable> pageMapTables;
+    initPageFrames(num_page_frames, pageFrames, memoryMapTable);
+    moveJobsToPages(jobs, jobTable, pageMapTables);
+    ReplacementState replacement;
+    initReplacementState(replacement, algorithm, num_page_frames);
+    initLocalAllocation(replacement, num_jobs, num_threads);
+    initPrefetch(replacement, num_jobs);
+    initHugePages(replacement, jobs, num_page_frames);
+    SIM->tlb.flush();
+    SIM->swap.reset(num_page_frames);
+
+    SimulatorContext* context = SIM;
+    auto worker = [&](int thread_no) {
+        SIM = context;
+        Xoshiro256 rng(12345 + thread_no);
+        int hot = max(1, STRESS_PAGES_PER_JOB / 10);
+        for (uint64_t i = 0; i < references_per_thread; ++i) {
+            int job_no = thread_no * STRESS_JOBS_PER_THREAD + (int)rng.below(STRESS_JOBS_PER_THREAD);
+            if (rng.below(STRESS_FOREIGN_ONE_IN) == 0) job_no = (int)rng.below(num_jobs);
+            int page_index = rng.below(10) != 0 ? (int)rng.below(hot) : (int)rng.below(STRESS_PAGES_PER_JOB);
+            referencePage(jobs[job_no], page_index, rng.below(4) == 0, pageFrames, memoryMapTable, jobTable, pageMapTables, replacement);
+        }
+        localThreadFinished(replacement);
+    };
+
+    SIM->event_log.start();
+    SIM->metrics.start(jobTable, algorithm, num_page_frames);
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (int t = 0; t < num_threads; ++t) threads.push_back(thread(worker, t));
+    for (auto& t : threads) t.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    SIM->event_log.stop();
+    SIM->metrics.stop();
+
+    if (check && validateMemoryState(pageFrames, memoryMapTable, jobTable, pageMapTables, replacement, references_per_thread * num_threads) > 0) {
+        return -1;
+    }
+    return seconds;
+}
+
+// Run the scheduler with slices overlapping on num_threads workers but fewer frames than
+// workers, then check the invariants. Returns the wall time in seconds, or -1 on a violation.
+double runSchedulerStress(int num_threads, uint64_t references_per_thread, ReplacementAlgorithm algorithm) {
+    vector<Job> jobs;
+    int num_jobs = num_threads * STRESS_JOBS_PER_THREAD;
+    for (int i = 0; i < num_jobs; ++i) {
+        Job job;
+        job.number = i;
+        job.size = STRESS_PAGES_PER_JOB * SIM->page_size;
+        jobs.push_back(job);
+    }
+    int num_page_frames = max(1, num_threads / 2);
+    FrameTable pageFrames;
+    vector<JobTableEntry> jobTable(jobs.size());
+    MemoryMapTable memoryMapTable;
+    vector<PageTable> pageMapTables;
+    initPageFrames(num_page_frames, pageFrames, memoryMapTable);
+    moveJobsToPages(jobs, jobTable, pageMapTables);
+
+    SchedulerSettings settings;
+    settings.quantum = 16;
+    settings.workers = num_threads;
+    settings.reproducible = false;
+    for (int i = 0; i < num_jobs; ++i) settings.priorities.push_back(1 + i % 3);
+    JobScheduler scheduler(jobs, settings, SIM->workload.seed, num_page_frames);
+
+    ReplacementState replacement;
+    initReplacementState(replacement, algorithm, num_page_frames);
+    initLocalAllocation(replacement, num_jobs, scheduler.workers());
+    setLocalPriorities(replacement, scheduler.priorityOrder());
+    initPrefetch(replacement, num_jobs);
+    initHugePages(replacement, jobs, num_page_frames);
+    SIM->tlb.flush();
+    SIM->swap.reset(num_page_frames);
+
+    // The jobs draw their references from the configured workload, in the stress test's number
+    uint64_t job_references = SIM->workload.references;
+    SIM->workload.references = max<uint64_t>(1, references_per_thread / STRESS_JOBS_PER_THREAD);
+    SIM->event_log.start();
+    SIM->metrics.start(jobTable, algorithm, num_page_frames);
+    auto start = chrono::steady_clock::now();
+    runScheduledJobs(jobs, scheduler, pageFrames, memoryMapTable, jobTable, pageMapTables, replacement);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    SIM->event_log.stop();
+    SIM->metrics.stop();
+    SIM->workload.references = job_references;
+
+    if (validateMemoryState(pageFrames, memoryMapTable, jobTable, pageMapTables, replacement, scheduler.referencesRun()) > 0) {
+        return -1;
+    }
+    return seconds;
+}
+
+// Cross-check frames, PMTs and the policy's bookkeeping after a run. Returns the number of
+// violations found, printing the first few.
+int validateMemoryState(FrameTable& pageFrames, MemoryMapTable& memoryMapTable, vector<JobTableEntry>& jobTable, vector<PageTable>& pageMapTables, ReplacementState& replacement, uint64_t references) {
+    int errors = 0;
+    auto fail = [&](const string& message) {
+        if (errors++ < 10) cout << "  violation: " << message << "\n";
+    };
+
+    // Every occupied frame is mapped by exactly the PMT entry of the page it holds, and its
+    // reverse map agrees with a lookup through the Job Table
+    // Idle frames of huge-page reservations are occupied without an owner
+    int occupied = 0, idle = 0;
+    const HugePageState& huge = replacement.huge;
+    for (int f = 0; f < pageFrames.size(); ++f) {
+        if (pageFrames.busy[f]) fail("frame " + to_string(f) + " still locked");
+        if (!memoryMapTable.isOccupied(f)) continue;
+        if (huge.active && !pageFrames.owner[f] && huge.reservation_of[f >> huge.shift] != -1) {
+            idle++;
+            continue;
+        }
+        occupied++;
+        PageMapTableEntry* entry = pageFrames.owner[f];
+        const JobTableEntry& owner_job = jobTable[pageFrames.job_no[f]];
+        if (!entry) fail("frame " + to_string(f) + " has no owner");
+        else if (entry != pageMapTables[owner_job.PMT_ID].find(pageFrames.page_no[f] - owner_job.first_page_no))
+            fail("frame " + to_string(f) + " reverse map points at the wrong PMT entry");
+        else if (!entry->present() || entry->frameNo() != f)
+            fail("frame " + to_string(f) + " holds page " + to_string(pageFrames.page_no[f]) + " whose PMT entry points elsewhere");
+    }
+
+    // Every resident PMT entry points at a frame that holds it, and no two share a frame
+    int resident = 0;
+    vector<bool> seen(pageFrames.size(), false);
+    for (auto& pageMapTable : pageMapTables) {
+        pageMapTable.forEachEntry([&](int page_no, PageMapTableEntry& entry) {
+            if (entry.loading()) fail("page " + to_string(page_no) + " still loading");
+            if (!entry.present()) return;
+            resident++;
+            int frame_no = entry.frameNo();
+            if (frame_no < 0 || frame_no >= (int)pageFrames.size() || pageFrames.page_no[frame_no] != page_no)
+                fail("page " + to_string(page_no) + " maps to frame " + to_string(frame_no) + " which holds another page");
+            else if (seen[frame_no])
+                fail("frame " + to_string(frame_no) + " is mapped twice");
+            else
+                seen[frame_no] = true;
+        });
+    }
+    if (idle != huge.idle_frames) fail(to_string(idle) + " idle reserved frames but " + to_string(huge.idle_frames) + " counted");
+    if (memoryMapTable.free_frames != (int)pageFrames.size() - occupied - idle) fail("free frame count is " + to_string(memoryMapTable.free_frames.load()));
+    if (resident != occupied) fail(to_string(resident) + " resident pages but " + to_string(occupied) + " occupied frames");
+
+    // Every huge region counts exactly its pages in memory
+    for (int job_no = 0; huge.active && job_no < (int)huge.jobs.size(); ++job_no) {
+        PageTable& table = pageMapTables[jobTable[job_no].PMT_ID];
+        for (int r = 0; r < (int)huge.jobs[job_no].size(); ++r) {
+            int present = 0;
+            for (int i = 0; i < huge.pages; ++i) {
+                PageMapTableEntry* entry = table.find((r << huge.shift) + i);
+                if (entry && entry->present()) present++;
+            }
+            if (present != huge.jobs[job_no][r].resident)
+                fail("huge region " + to_string(r) + " of job " + to_string(job_no + 1) + " has " + to_string(present) + " pages in memory but counts " + to_string(huge.jobs[job_no][r].resident));
+        }
+    }
+
+    // The policy tracks exactly the occupied frames
+    int tracked = -1;
+    switch (replacement.algorithm) {
+    case ReplacementAlgorithm::FIFO:
+    case ReplacementAlgorithm::LRU:
+    case ReplacementAlgorithm::SECOND_CHANCE:
+        tracked = replacement.queue.size;
+        break;
+    case ReplacementAlgorithm::ARC:
+        tracked = replacement.arc.t1.size + replacement.arc.t2.size;
+        break;
+    case ReplacementAlgorithm::TWO_Q:
+        tracked = replacement.twoQ.a1in.size + replacement.twoQ.am.size;
+        break;
+    case ReplacementAlgorithm::LIRS:
+        tracked = replacement.lirs.lir_count + (int)replacement.lirs.queue.size();
+        break;
+    default:
+        break;
+    }
+    if (replacement.local.mode != FrameAllocation::GLOBAL) {
+        // Local allocation keeps every frame on its job's resident set instead
+        tracked = 0;
+        for (const auto& residentSet : replacement.local.jobs) tracked += residentSet.frames.size;
+    }
+    if (tracked != -1 && tracked != occupied) fail("policy tracks " + to_string(tracked) + " frames but " + to_string(occupied) + " are occupied");
+
+    if (replacement.hits + replacement.misses != references)
+        fail(to_string(replacement.hits + replacement.misses) + " hits and misses for " + to_string(references) + " references");
+
+    // The per-job counters add up to the same totals
+    PagingCounters total = totalCounters(jobTable);
+    if (total.hits + total.faults != references)
+        fail("job counters record " + to_string(total.hits + total.faults) + " references for " + to_string(references));
+    if (total.resident != occupied) fail("job counters record " + to_string(total.resident.load()) + " resident pages for " + to_string(occupied) + " occupied frames");
+    if (total.faults + total.prefetches + huge.fills - total.evictions != (uint64_t)occupied)
+        fail(to_string(total.faults + total.prefetches + huge.fills) + " loads and " + to_string(total.evictions.load()) + " evictions leave the wrong number of frames occupied");
+
+    // Every TLB entry still matches the PMT, so no eviction left a stale translation behind
+    for (const auto& entry : SIM->tlb.contents()) {
+        if (entry.asid == -1) continue;
+        if (entry.vpn < -1) {
+            // A huge page's entry maps its run through the region's first page; other pages
+            // are confirmed against the PMT on every hit
+            int region = -2 - entry.vpn;
+            PageMapTableEntry* row = pageMapTables[jobTable[entry.asid].PMT_ID].find(region << huge.shift);
+            if (!huge.active || !row || !row->present() || row->frameNo() != entry.frame_no)
+                fail("TLB maps huge region " + to_string(region) + " of job " + to_string(entry.asid + 1) + " to frame " + to_string(entry.frame_no) + " but the PMT disagrees");
+            continue;
+        }
+        PageMapTableEntry* row = pageMapTables[jobTable[entry.asid].PMT_ID].find(entry.vpn);
+        if (!row || row != entry.pte || !row->present() || row->frameNo() != entry.frame_no)
+            fail("TLB maps page " + to_string(entry.vpn) + " of job " + to_string(entry.asid + 1) + " to frame " + to_string(entry.frame_no) + " but the PMT disagrees");
+    }
+    if (SIM->tlb.enabled() && SIM->tlb.hits + SIM->tlb.misses != references)
+        fail(to_string(SIM->tlb.hits + SIM->tlb.misses) + " TLB lookups for " + to_string(references) + " references");
+    return errors;
+}
+
+// --stress: run the workload concurrently and check the invariants afterwards. The second run
+// has fewer frames than threads, so faults find every frame claimed and still loading; the
+// third runs the same shortage through the job scheduler.
+int runStressTest(int num_threads, uint64_t references_per_thread, ReplacementAlgorithm algorithm) {
+    cout << "Stress test: " << num_threads << " threads x " << references_per_thread << " references using "
+         << algorithmName(algorithm) << "\n";
+    double seconds = runStressWorkload(num_threads, references_per_thread, algorithm, true, 0);
+    if (seconds < 0) {
+        cout << "FAILED\n";
+        return 1;
+    }
+    cout << "PASSED in " << seconds << " s\n";
+    SIM->tlb.printStats();
+
+    int starved_frames = max(1, num_threads / 2);
+    cout << "Stress test with " << starved_frames << (starved_frames == 1 ? " frame" : " frames") << "\n";
+    seconds = runStressWorkload(num_threads, references_per_thread, algorithm, true, starved_frames);
+    if (seconds < 0) {
+        cout << "FAILED\n";
+        return 1;
+    }
+    cout << "PASSED in " << seconds << " s\n";
+
+    cout << "Scheduler stress test with " << starved_frames << (starved_frames == 1 ? " frame" : " frames") << "\n";
+    seconds = runSchedulerStress(num_threads, references_per_thread, algorithm);
+    if (seconds < 0) {
+        cout << "FAILED\n";
+        return 1;
+    }
+    cout << "PASSED in " << seconds << " s\n";
+    return 0;
+}
+
+// --scaling: split a fixed number of references over 1, 2, 4, ... max_threads threads.
+// Each thread brings its own jobs, so the memory per thread stays the same.
+int runScalingBenchmark(int max_threads, uint64_t total_references, ReplacementAlgorithm algorithm) {
+    cout << "Scaling benchmark: " << total_references << " references using " << algorithmName(algorithm) << "\n";
+    cout << setw(8) << "threads" << setw(12) << "seconds" << setw(16) << "references/s" << setw(10) << "speedup" << "\n";
+    double base = 0;
+    for (int threads = 1; threads <= max_threads; threads = (threads * 2 > max_threads && threads < max_threads) ? max_threads : threads * 2) {
+        double seconds = runStressWorkload(threads, total_references / threads, algorithm, false, 0);
+        if (threads == 1) base = seconds;
+        cout << setw(8) << threads << setw(12) << fixed << setprecision(3) << seconds << setw(16) << setprecision(0)
+             << total_references / seconds << setw(10) << setprecision(2) << base / seconds << "\n";
+        cout.unsetf(ios::fixed);
+        cout << setprecision(6);
+    }
+    return 0;
+}
+
+void printUsage(const char* program) {
+    cout << "Usage:\n"
+         << "  " << program << "                                   interactive simulation\n"
+         << "  " << program << " --replay <trace> [options]        replay a binary trace\n"
+         << "  " << program << " --import-lackey <out> <in>...     convert Valgrind lackey output (one job per file)\n"
+         << "  " << program << " --import-plain <out> <in>         convert \"<job> <address> [R|W]\" lines\n"
+         << "  " << program << " --build-next-use <trace>          precompute the OPT next-use index\n"
+         << "  " << program << " --stack-distance <trace>          LRU and OPT faults for every memory size in one pass\n"
+         << "  " << program << " --simulate [options] <size>...   run the threaded simulation on jobs of these sizes\n"
+         << "  " << program << " --generate-trace <out> <size>... write the workload of jobs of these sizes as a trace\n"
+         << "  " << program << " --sweep [options] <size>...      simulate a grid of configurations in parallel, one CSV row each\n"
+         << "  " << program << " --stress [options]                check paging invariants under concurrent load\n"
+         << "  " << program << " --scaling [options]               measure throughput from 1 to --threads threads\n"
+         << "Options:\n"
+         << "  --algorithm <name>     FIFO, LRU, CLOCK, SC (second chance), ECLOCK (enhanced CLOCK),\n"
+         << "                         ARC, 2Q, LIRS or OPT (replay only); default LRU. --stress also takes all\n"
+         << "  --memory <bytes>       total physical memory (default " << SIM->total_memory << ")\n"
+         << "  --max-frames <n>       largest memory --stack-distance reports, in frames (default: all pages)\n"
+         << "  --curve <path>         --stack-distance: write the fault curves for every frame count as CSV\n"
+         << "  --page-size <bytes>    page and frame size (default " << SIM->page_size << ")\n"
+         << "  --page-table-levels <n> 1 for flat PMTs (default), 2-4 for radix page tables\n"
+         << "  --allocation <mode>    global (default): the algorithm evicts any job's page; ws or pff:\n"
+         << "                         per-job resident sets sized by working set or page fault frequency,\n"
+         << "                         replaced by second chance within the job\n"
+         << "  --ws-window <n>        working set window in references of the job (default " << SIM->ws_window << ")\n"
+         << "  --pff-interval <n>     PFF grows a job that faults again within n references (default " << SIM->pff_interval << ")\n"
+         << "  --no-load-control      never suspend jobs when local allocation overcommits memory\n"
+         << "  --prefetch <pages>     read ahead up to this many pages in detected streams (default 0: off)\n"
+         << "  --prefetch-stride <n>  largest stride between faults taken for a stream (default " << SIM->prefetch_max_stride << ")\n"
+         << "  --huge-page-size <bytes> group pages into huge pages of this size (a power-of-two multiple\n"
+         << "                         of --page-size), promoted and demoted by access density (default off)\n"
+         << "  --huge-promote <share> promote a region when this share of its pages is referenced between\n"
+         << "                         scans (default " << SIM->huge_promote_density << ")\n"
+         << "  --huge-demote <share>  split a huge page referenced less densely than this (default " << SIM->huge_demote_density << ")\n"
+         << "  --reference-time <ns>  simulated CPU time of one reference (default " << SIM->reference_ns << ")\n"
+         << "  --swap-read-latency <ns>, --swap-write-latency <ns>\n"
+         << "                         swap device latency per request (default 100000 each)\n"
+         << "  --swap-read-bandwidth <MB/s>, --swap-write-bandwidth <MB/s>\n"
+         << "                         swap device transfer rate (default 500 each)\n"
+         << "  --swap-queue-depth <n> requests the swap device serves at once (default 4)\n"
+         << "  --swap-cluster <n>     write dirty victims back in batches of up to n pages (default 1)\n"
+         << "  --swap-sync-writes     make the faulting job wait for its victim's write-back\n"
+         << "  --real-memory          --replay on real memory (Linux): frames are an mmap'd arena, pages fault\n"
+         << "                         through a SIGSEGV handler and are paged to a store file\n"
+         << "  --store <path>         page store for --real-memory (default: a temporary file)\n"
+         << "  --log-level <level>    silent (default), faults, all (also hits and address resolution)\n"
+         << "                         or snapshots (also the frames changed since the last batch)\n"
+         << "  --log-format <format>  text (default), ndjson or binary\n"
+         << "  --log-file <path>      write the event log here instead of stdout\n"
+         << "  --verbose              same as --log-level all\n"
+         << "  --metrics <prefix>     write counters, latency histograms and resident set size to\n"
+         << "                         <prefix>.json and <prefix>.prom (Prometheus text format)\n"
+         << "  --metrics-interval <s> rewrite the metrics files this often during a run (default 1)\n"
+         << "  --metrics-sample <n>   sample the resident set size every n references (default 10000)\n"
+         << "  --workload <model>     references of --simulate and --generate-trace: uniform (default), zipf,\n"
+         << "                         sequential, loop, stride, hotcold or phase\n"
+         << "  --job-references <n>   references per job (default: one per page)\n"
+         << "  --seed <n>             workload seed; equal seeds give equal reference strings (default 1)\n"
+         << "  --write-ratio <share>  share of references that write (default " << SIM->workload.write_ratio << ")\n"
+         << "  --zipf-theta <theta>   zipf skew, between 0 and 1 (default " << SIM->workload.zipf_theta << ")\n"
+         << "  --workload-window <n>  pages of a loop or a phase's working set (default: a quarter of the job)\n"
+         << "  --stride <pages>       distance between references of the stride model (default " << SIM->workload.stride << ")\n"
+         << "  --hot-fraction <share>, --hot-probability <share>\n"
+         << "                         hotcold: the hot pages and the references they get (default "
+         << SIM->workload.hot_fraction << ", " << SIM->workload.hot_probability << ")\n"
+         << "  --phase-length <n>     references before the phase model moves its window (default " << SIM->workload.phase_length << ")\n"
+         << "  --quantum <n>          references per time slice of --simulate (default " << SIM->scheduler.quantum << ")\n"
+         << "  --priorities <p,...>   scheduling priority of each job in turn, higher gets more slices (default 1)\n"
+         << "  --max-active <n>       jobs --simulate runs at once; the rest wait in priority order (default: all)\n"
+         << "  --free-running         let --simulate run slices on all workers at once; faster, but the\n"
+         << "                         interleaving then depends on thread timing as well as --seed\n"
+         << "  --sweep-algorithms <a,b,...>, --sweep-frames <n,...>, --sweep-page-sizes <bytes,...>,\n"
+         << "  --sweep-workloads <model,...>\n"
+         << "                         the --sweep grid; each defaults to --algorithm, --memory, --page-size, --workload\n"
+         << "                         (--huge-page-size stays the same in bytes at every page size)\n"
+         << "  --csv <path>           write the --sweep results here instead of stdout\n"
+         << "  --threads <n>          worker threads for --simulate, --stress, --scaling and --sweep (default: all cores)\n"
+         << "  --references <n>       references per thread (--stress) or in total (--scaling)\n"
+         << "  --tlb-entries <n>      TLB size, 0 disables it (default 64)\n"
+         << "  --tlb-ways <n>         TLB associativity, 0 for fully associative (default 4)\n"
+         << "  --tlb-policy <name>    TLB replacement: LRU, FIFO or RANDOM (default LRU)\n";
+}
+
+// Non-interactive entry point driven by command line arguments
+int runBatch(int argc, char* argv[]) {
+    string mode, algorithmArg = "LRU";
+    vector<string> paths;
+    string logLevelArg = "silent", logFormatArg = "text", logFile;
+    string metricsPrefix, curvePath;
+    int maxFrames = 0;
+    double metricsInterval = 1.0;
+    uint64_t metricsSample = 10000;
+    int num_threads = max(1, (int)thread::hardware_concurrency());
+    uint64_t references = 0;
+    int tlbEntries = 64, tlbWays = 4;
+    string tlbPolicyArg = "LRU";
+    string allocationArg = "global";
+    uint64_t swapReadLatency = 100000, swapWriteLatency = 100000;
+    double swapReadBandwidth = 500, swapWriteBandwidth = 500;
+    int swapQueueDepth = 4, swapCluster = 1;
+    bool swapSyncWrites = false;
+    bool realMemory = false;
+    string storePath;
+    uint64_t hugePageSize = 0;
+    string workloadArg = "uniform";
+    string prioritiesArg;
+    string sweepAlgorithms, sweepFrames, sweepPageSizes, sweepWorkloads, csvPath;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--replay" || arg == "--import-lackey" || arg == "--import-plain" || arg == "--build-next-use"
+            || arg == "--stack-distance" || arg == "--stress" || arg == "--scaling" || arg == "--simulate" || arg == "--generate-trace" || arg == "--sweep") {
+            mode = arg;
+        } else if (arg == "--threads" && hasValue) {
+            num_threads = max(1, atoi(argv[++i]));
+        } else if (arg == "--references" && hasValue) {
+            references = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--algorithm" && hasValue) {
+            algorithmArg = argv[++i];
+        } else if (arg == "--memory" && hasValue) {
+            SIM->total_memory = atoi(argv[++i]);
+        } else if (arg == "--max-frames" && hasValue) {
+            maxFrames = atoi(argv[++i]);
+        } else if (arg == "--curve" && hasValue) {
+            curvePath = argv[++i];
+        } else if (arg == "--page-size" && hasValue) {
+            SIM->page_size = atoi(argv[++i]);
+        } else if (arg == "--tlb-entries" && hasValue) {
+            tlbEntries = atoi(argv[++i]);
+        } else if (arg == "--tlb-ways" && hasValue) {
+            tlbWays = atoi(argv[++i]);
+        } else if (arg == "--tlb-policy" && hasValue) {
+            tlbPolicyArg = argv[++i];
+        } else if (arg == "--page-table-levels" && hasValue) {
+            SIM->page_table_levels = atoi(argv[++i]);
+        } else if (arg == "--allocation" && hasValue) {
+            allocationArg = argv[++i];
+        } else if (arg == "--ws-window" && hasValue) {
+            SIM->ws_window = max<uint64_t>(1, strtoull(argv[++i], nullptr, 10));
+        } else if (arg == "--pff-interval" && hasValue) {
+            SIM->pff_interval = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--no-load-control") {
+            SIM->load_control = false;
+        } else if (arg == "--prefetch" && hasValue) {
+            SIM->prefetch_window = max(0, atoi(argv[++i]));
+        } else if (arg == "--prefetch-stride" && hasValue) {
+            SIM->prefetch_max_stride = max(1, atoi(argv[++i]));
+        } else if (arg == "--sweep-algorithms" && hasValue) {
+            sweepAlgorithms = argv[++i];
+        } else if (arg == "--sweep-frames" && hasValue) {
+            sweepFrames = argv[++i];
+        } else if (arg == "--sweep-page-sizes" && hasValue) {
+            sweepPageSizes = argv[++i];
+        } else if (arg == "--sweep-workloads" && hasValue) {
+            sweepWorkloads = argv[++i];
+        } else if (arg == "--csv" && hasValue) {
+            csvPath = argv[++i];
+        } else if (arg == "--workload" && hasValue) {
+            workloadArg = argv[++i];
+        } else if (arg == "--job-references" && hasValue) {
+            SIM->workload.references = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--quantum" && hasValue) {
+            SIM->scheduler.quantum = max<uint64_t>(1, strtoull(argv[++i], nullptr, 10));
+        } else if (arg == "--priorities" && hasValue) {
+            prioritiesArg = argv[++i];
+        } else if (arg == "--max-active" && hasValue) {
+            SIM->scheduler.max_active = max(0, atoi(argv[++i]));
+        } else if (arg == "--free-running") {
+            SIM->scheduler.reproducible = false;
+        } else if (arg == "--seed" && hasValue) {
+            SIM->workload.seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--write-ratio" && hasValue) {
+            SIM->workload.write_ratio = atof(argv[++i]);
+        } else if (arg == "--zipf-theta" && hasValue) {
+            SIM->workload.zipf_theta = atof(argv[++i]);
+        } else if (arg == "--workload-window" && hasValue) {
+            SIM->workload.window = max(0, atoi(argv[++i]));
+        } else if (arg == "--stride" && hasValue) {
+            SIM->workload.stride = max(1, atoi(argv[++i]));
+        } else if (arg == "--hot-fraction" && hasValue) {
+            SIM->workload.hot_fraction = atof(argv[++i]);
+        } else if (arg == "--hot-probability" && hasValue) {
+            SIM->workload.hot_probability = atof(argv[++i]);
+        } else if (arg == "--phase-length" && hasValue) {
+            SIM->workload.phase_length = max<uint64_t>(1, strtoull(argv[++i], nullptr, 10));
+        } else if (arg == "--huge-page-size" && hasValue) {
+            hugePageSize = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--huge-promote" && hasValue) {
+            SIM->huge_promote_density = atof(argv[++i]);
+        } else if (arg == "--huge-demote" && hasValue) {
+            SIM->huge_demote_density = atof(argv[++i]);
+        } else if (arg == "--reference-time" && hasValue) {
+            SIM->reference_ns = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--swap-read-latency" && hasValue) {
+            swapReadLatency = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--swap-write-latency" && hasValue) {
+            swapWriteLatency = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--swap-read-bandwidth" && hasValue) {
+            swapReadBandwidth = atof(argv[++i]);
+        } else if (arg == "--swap-write-bandwidth" && hasValue) {
+            swapWriteBandwidth = atof(argv[++i]);
+        } else if (arg == "--swap-queue-depth" && hasValue) {
+            swapQueueDepth = atoi(argv[++i]);
+        } else if (arg == "--swap-cluster" && hasValue) {
+            swapCluster = atoi(argv[++i]);
+        } else if (arg == "--swap-sync-writes") {
+            swapSyncWrites = true;
+        } else if (arg == "--real-memory") {
+            realMemory = true;
+        } else if (arg == "--store" && hasValue) {
+            storePath = argv[++i];
+        } else if (arg == "--log-level" && hasValue) {
+            logLevelArg = argv[++i];
+        } else if (arg == "--log-format" && hasValue) {
+            logFormatArg = argv[++i];
+        } else if (arg == "--log-file" && hasValue) {
+            logFile = argv[++i];
+        } else if (arg == "--metrics" && hasValue) {
+            metricsPrefix = argv[++i];
+        } else if (arg == "--metrics-interval" && hasValue) {
+            metricsInterval = atof(argv[++i]);
+        } else if (arg == "--metrics-sample" && hasValue) {
+            metricsSample = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--verbose") {
+            logLevelArg = "all";
+        } else if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (arg.rfind("--", 0) == 0) {
+            cout << "Unknown option " << arg << "\n";
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+
+    if (SIM->page_size <= 0 || SIM->total_memory < SIM->page_size) {
+        cout << "Memory must hold at least one page\n";
+        return 1;
+    }
+    if (SIM->page_table_levels < 1 || SIM->page_table_levels > 4) {
+        cout << "--page-table-levels must be 1, 2, 3 or 4\n";
+        return 1;
+    }
+    // --stress takes "all" to test every policy that runs without a trace
+    bool stressAll = mode == "--stress" && algorithmArg == "all";
+    ReplacementAlgorithm algorithm;
+    if (!parseAlgorithm(stressAll ? "LRU" : algorithmArg, algorithm)) {
+        cout << "Unknown algorithm " << algorithmArg << "\n";
+        return 1;
+    }
+    if (!parseWorkloadModel(workloadArg, SIM->workload.model)) {
+        cout << "Unknown workload " << workloadArg << "\n";
+        return 1;
+    }
+    if (SIM->workload.zipf_theta <= 0 || SIM->workload.zipf_theta >= 1) {
+        cout << "--zipf-theta must lie between 0 and 1\n";
+        return 1;
+    }
+    if (!parseFrameAllocation(allocationArg, SIM->frame_allocation)) {
+        cout << "Unknown frame allocation " << allocationArg << "\n";
+        return 1;
+    }
+    if (algorithm == ReplacementAlgorithm::OPT && SIM->prefetch_window > 0) {
+        cout << "OPT knows the next use of referenced pages only; --prefetch is ignored\n";
+        SIM->prefetch_window = 0;
+    }
+    if (hugePageSize > 0) {
+        uint64_t ratio = hugePageSize / SIM->page_size;
+        if (hugePageSize % SIM->page_size != 0 || ratio < 2 || (ratio & (ratio - 1)) != 0) {
+            cout << "--huge-page-size must be a power-of-two multiple of --page-size, at least twice it\n";
+            return 1;
+        }
+        SIM->huge_page_pages = (int)ratio;
+        if (algorithm == ReplacementAlgorithm::OPT || SIM->frame_allocation != FrameAllocation::GLOBAL) {
+            cout << "Huge pages need global allocation and an online policy; --huge-page-size is ignored\n";
+            SIM->huge_page_pages = 0;
+        }
+    }
+    LogLevel logLevel;
+    LogFormat logFormat;
+    if (!parseLogLevel(logLevelArg, logLevel) || !parseLogFormat(logFormatArg, logFormat)) {
+        cout << "Unknown log level or format\n";
+        return 1;
+    }
+    if (!SIM->event_log.configure(logLevel, logFormat, logFile)) return 1;
+    SIM->metrics.configure(metricsPrefix, metricsInterval, metricsSample);
+    TlbReplacement tlbPolicy;
+    if (!parseTlbReplacement(tlbPolicyArg, tlbPolicy)) {
+        cout << "Unknown TLB policy " << tlbPolicyArg << "\n";
+        return 1;
+    }
+    if (!SIM->tlb.configure(tlbEntries, tlbWays, tlbPolicy)) {
+        cout << "The TLB needs a whole number of sets: --tlb-entries must be a multiple of --tlb-ways\n";
+        return 1;
+    }
+    if (!SIM->swap.configure(swapReadLatency, swapWriteLatency, swapReadBandwidth, swapWriteBandwidth, swapQueueDepth, swapCluster, swapSyncWrites)) {
+        cout << "Swap bandwidths must be positive, and the queue depth and cluster size at least 1\n";
+        return 1;
+    }
+    SIM->mmap_engine.configure(realMemory, storePath);
+
+    if (mode == "--replay" && paths.size() == 1) {
+        return replayTrace(paths[0], algorithm);
+    }
+    if (mode == "--import-lackey" && paths.size() >= 2) {
+        vector<string> inputs(paths.begin() + 1, paths.end());
+        return importLackeyTrace(inputs, paths[0], SIM->page_size) ? 0 : 1;
+    }
+    if (mode == "--import-plain" && paths.size() == 2) {
+        return importPlainTrace(paths[1], paths[0]) ? 0 : 1;
+    }
+    if (mode == "--build-next-use" && paths.size() == 1) {
+        return buildNextUseIndex(paths[0], SIM->page_size) ? 0 : 1;
+    }
+    if (mode == "--stack-distance" && paths.size() == 1) {
+        return analyzeStackDistances(paths[0], maxFrames, curvePath);
+    }
+    if (mode == "--generate-trace" && paths.size() >= 2) {
+        vector<uint64_t> sizes;
+        for (size_t p = 1; p < paths.size(); ++p) sizes.push_back(strtoull(paths[p].c_str(), nullptr, 10));
+        return generateTrace(paths[0], sizes) ? 0 : 1;
+    }
+    if (algorithm == ReplacementAlgorithm::OPT && (mode == "--stress" || mode == "--scaling" || mode == "--simulate")) {
+        cout << "OPT needs a trace; use --replay\n";
+        return 1;
+    }
+    if (mode == "--simulate" && !paths.empty()) {
+        vector<Job> jobs;
+        for (size_t p = 0; p < paths.size(); ++p) {
+            Job job;
+            job.number = (int)p;
+            job.size = strtoull(paths[p].c_str(), nullptr, 10);
+            jobs.push_back(job);
+        }
+        if (!prioritiesArg.empty() && !parseList<int>(prioritiesArg, SIM->scheduler.priorities, parsePositive)) {
+            cout << "Priorities must be positive numbers: " << prioritiesArg << "\n";
+            return 1;
+        }
+        SIM->scheduler.workers = num_threads;
+        simulateJobs(jobs, algorithm);
+        return 0;
+    }
+    if (mode == "--sweep" && !paths.empty()) {
+        vector<uint64_t> sizes;
+        for (const auto& path : paths) sizes.push_back(strtoull(path.c_str(), nullptr, 10));
+        vector<ReplacementAlgorithm> algorithms;
+        vector<int> frameCounts, pageSizes;
+        vector<WorkloadModel> workloads;
+        if (!parseList<ReplacementAlgorithm>(sweepAlgorithms.empty() ? algorithmArg : sweepAlgorithms, algorithms, parseAlgorithm)
+            || !parseList<int>(sweepFrames.empty() ? to_string(SIM->total_memory / SIM->page_size) : sweepFrames, frameCounts, parsePositive)
+            || !parseList<int>(sweepPageSizes.empty() ? to_string(SIM->page_size) : sweepPageSizes, pageSizes, parsePositive)
+            || !parseList<WorkloadModel>(sweepWorkloads.empty() ? workloadArg : sweepWorkloads, workloads, parseWorkloadModel)) {
+            cout << "Cannot parse the sweep grid\n";
+            return 1;
+        }
+        if (SIM->mmap_engine.requestedRun()) {
+            cout << "--real-memory replays a single trace; it cannot be swept\n";
+            return 1;
+        }
+        return runSweep(sizes, algorithms, frameCounts, pageSizes, workloads, num_threads, csvPath);
+    }
+    if (mode == "--stress" && paths.empty() && stressAll) {
+        int failed = 0;
+        for (int a = (int)ReplacementAlgorithm::FIFO; a < (int)ReplacementAlgorithm::OPT; ++a) {
+            failed += runStressTest(num_threads, references > 0 ? references : 200000, (ReplacementAlgorithm)a);
+        }
+        return failed > 0 ? 1 : 0;
+    }
+    if (mode == "--stress" && paths.empty()) {
+        return runStressTest(num_threads, references > 0 ? references : 200000, algorithm);
+    }
+    if (mode == "--scaling" && paths.empty()) {
+        return runScalingBenchmark(num_threads, references > 0 ? references : 2000000, algorithm);
+    }
+    printUsage(argv[0]);
+    return 1;
 }
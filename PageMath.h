@@ -0,0 +1,14 @@
+// Page arithmetic shared by the paging simulators
+#pragma once
+#include <cstdint>
+
+// Pages needed to hold size bytes
+inline uint64_t pagesFor(uint64_t size, uint64_t page_size) {
+    return (size + page_size - 1) / page_size;
+}
+
+// Bytes left unused in the last page of something size bytes long: the internal fragmentation
+inline uint64_t internalFragmentation(uint64_t size, uint64_t page_size) {
+    uint64_t last_page = size % page_size;
+    return last_page == 0 ? 0 : page_size - last_page;
+}
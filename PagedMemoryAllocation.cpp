@@ -4,6 +4,7 @@
 #include <iomanip>
 #include <cstdlib>
 #include <ctime>
+#include "PageMath.h"
 
 using namespace std;
 
@@ -71,7 +72,7 @@ public:
         cout << "\nDIVIDE JOB INTO PAGES" << endl;
 
         // Calculate number of pages
-        int numPages = (currentJob.jobSize + PAGE_SIZE - 1) / PAGE_SIZE;
+        int numPages = (int)pagesFor(currentJob.jobSize, PAGE_SIZE);
 
         cout << "Job Size: " << currentJob.jobSize << " bytes" << endl;
         cout << "Page Size: " << PAGE_SIZE << " bytes" << endl;
@@ -79,11 +80,7 @@ public:
 
         // Calculate internal fragmentation
         int lastPage = currentJob.jobSize % PAGE_SIZE;
-        int internalFragmentation = 0;
-
-        if (lastPage != 0) {
-            internalFragmentation = PAGE_SIZE - lastPage;
-        }
+        int internalFragmentation = (int)::internalFragmentation(currentJob.jobSize, PAGE_SIZE);
 
         for (int i = 0; i < numPages; i++) {
             currentJob.pageNumbers.push_back(i);
@@ -0,0 +1,365 @@
+// Benchmark for the paging core: runs every combination of replacement policy, frame count,
+// page size, job count and access distribution over a generated reference string and reports
+// throughput, faults, peak memory and the cost of batch address translation as CSV.
+// Each configuration runs in a child process of its own, so its peak memory is its own. With --baseline it compares against an earlier
+// CSV and exits with 1 when a configuration got slower than the tolerance or its faults changed.
+#define PAGING_NO_MAIN
+#include "DemandPagedMemoryAllocation.cpp"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// One generated reference
+struct BenchReference {
+    int job_no;
+    uint64_t logical_addr;
+    bool is_write;
+};
+
+const int BENCH_LINE = 64;            // granularity of generated addresses
+
+struct BenchConfig {
+    ReplacementAlgorithm algorithm;
+    int frames, page_size, jobs;
+    WorkloadModel distribution;
+};
+
+struct BenchResult {
+    uint64_t references = 0, faults = 0;
+    double seconds = 0, translate_seconds = 0;
+    long peak_rss_kb = 0;         // -1 when it cannot be measured
+};
+
+struct BenchOptions {
+    vector<ReplacementAlgorithm> algorithms;
+    vector<int> frames = {64, 256, 1024};
+    vector<int> page_sizes = {256, 4096};
+    vector<int> jobs = {1, 8};
+    vector<WorkloadModel> distributions = {WorkloadModel::UNIFORM, WorkloadModel::HOT_COLD, WorkloadModel::ZIPF, WorkloadModel::SEQUENTIAL};
+    uint64_t references = 100000;
+    uint64_t job_size = 1 << 20;
+    int repeat = 3;
+    string output, baseline;
+    double tolerance = 10.0;    // percent slower than the baseline that still passes
+};
+
+// Generate the reference string of one configuration with the simulator's workload generators,
+// so the benchmark and --simulate draw from the same distributions. Addresses are generated at
+// BENCH_LINE granularity, which keeps the string the same for every page size. Jobs take turns
+// at random; seeded, so every run of a configuration is identical.
+vector<BenchReference> generateReferences(const BenchOptions& options, int num_jobs, WorkloadModel distribution) {
+    int page_size = SIM->page_size;
+    WorkloadSettings workload = SIM->workload;
+    SIM->page_size = BENCH_LINE;
+    SIM->workload.model = distribution;
+    SIM->workload.references = max<uint64_t>(1, options.references / num_jobs);
+
+    vector<BenchReference> references;
+    references.reserve(SIM->workload.references * num_jobs);
+    generateWorkload(vector<uint64_t>(num_jobs, options.job_size), [&](int job_no, uint64_t logical_addr, bool is_write) {
+        references.push_back({job_no, logical_addr, is_write});
+    });
+    SIM->page_size = page_size;
+    SIM->workload = workload;
+    return references;
+}
+
+// The position of the next reference to the same page, as OPT expects it
+vector<uint64_t> nextUses(const vector<BenchReference>& references, int page_size) {
+    vector<uint64_t> next(references.size());
+    unordered_map<uint64_t, uint64_t> nextPosition;
+    for (uint64_t i = references.size(); i-- > 0;) {
+        uint64_t key = ((uint64_t)references[i].job_no << 40) | (references[i].logical_addr / page_size);
+        auto it = nextPosition.find(key);
+        next[i] = it == nextPosition.end() ? NEVER_USED_AGAIN : it->second;
+        nextPosition[key] = i;
+    }
+    return next;
+}
+
+// Replay the reference string once on fresh tables
+BenchResult runBenchmark(const BenchConfig& config, const BenchOptions& options, const vector<BenchReference>& references, const vector<uint64_t>& next) {
+    SIM->page_size = config.page_size;
+    SIM->total_memory = config.frames * config.page_size;
+    vector<Job> jobs;
+    for (int i = 0; i < config.jobs; ++i) {
+        Job job;
+        job.number = i;
+        job.size = options.job_size;
+        jobs.push_back(job);
+    }
+    FrameTable pageFrames;
+    vector<JobTableEntry> jobTable(jobs.size());
+    MemoryMapTable memoryMapTable;
+    vector<PageTable> pageMapTables;
+    initPageFrames(config.frames, pageFrames, memoryMapTable);
+    moveJobsToPages(jobs, jobTable, pageMapTables);
+    ReplacementState replacement;
+    initReplacementState(replacement, config.algorithm, config.frames);
+    SIM->tlb.flush();
+    SIM->swap.reset(config.frames);
+
+    BenchResult result;
+    bool opt = config.algorithm == ReplacementAlgorithm::OPT;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < references.size(); ++i) {
+        const BenchReference& reference = references[i];
+        if (opt) replacement.opt.current_next_use = next[i];
+        if (referencePage(jobs[reference.job_no], (int)(reference.logical_addr / config.page_size), reference.is_write,
+                          pageFrames, memoryMapTable, jobTable, pageMapTables, replacement)) {
+            result.faults++;
+        }
+    }
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    result.references = references.size();
+
+    // Translate every address again through the batch API, one job's addresses at a time,
+    // against the page tables as the run left them
+    vector<vector<uint64_t>> addresses(config.jobs);
+    for (const BenchReference& reference : references) addresses[reference.job_no].push_back(reference.logical_addr);
+    vector<int64_t> physical(references.size());
+    start = chrono::steady_clock::now();
+    for (int j = 0; j < config.jobs; ++j) translateBatch(jobTable[j], pageMapTables, addresses[j].data(), addresses[j].size(), physical.data());
+    result.translate_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+// Run a configuration options.repeat times and keep the fastest run. On POSIX the runs happen
+// in a forked child, and the child's own high-water mark of resident memory becomes the
+// configuration's peak: this process's ru_maxrss only ever grows, so it cannot tell
+// configurations apart. Windows has no fork and reports no peak (-1).
+BenchResult runConfiguration(const BenchConfig& config, const BenchOptions& options, const vector<BenchReference>& references, const vector<uint64_t>& next) {
+    auto fastest = [&]() {
+        BenchResult best;
+        for (int r = 0; r < options.repeat; ++r) {
+            BenchResult result = runBenchmark(config, options, references, next);
+            if (r == 0 || result.seconds < best.seconds) best = result;
+        }
+        return best;
+    };
+#ifndef _WIN32
+    int fds[2];
+    pid_t pid = pipe(fds) == 0 ? fork() : -1;
+    if (pid == 0) {
+        close(fds[0]);
+        BenchResult best = fastest();
+        ssize_t written = write(fds[1], &best, sizeof(best));
+        _exit(written == (ssize_t)sizeof(best) ? 0 : 1);   // without flushing the parent's buffered output
+    }
+    if (pid > 0) {
+        close(fds[1]);
+        BenchResult best;
+        bool received = read(fds[0], &best, sizeof(best)) == (ssize_t)sizeof(best);
+        close(fds[0]);
+        int status = 0;
+        struct rusage usage;
+        if (wait4(pid, &status, 0, &usage) == pid && received) {
+#ifdef __APPLE__
+            best.peak_rss_kb = usage.ru_maxrss / 1024;
+#else
+            best.peak_rss_kb = usage.ru_maxrss;
+#endif
+            return best;
+        }
+        cerr << "The run of " << algorithmName(config.algorithm) << " in a child process failed; running it here\n";
+    }
+#endif
+    BenchResult best = fastest();
+    best.peak_rss_kb = -1;
+    return best;
+}
+
+// The columns that identify a configuration in a CSV row
+string configKey(const BenchConfig& config, uint64_t references) {
+    ostringstream key;
+    key << algorithmName(config.algorithm) << "," << config.frames << "," << config.page_size << ","
+        << config.jobs << "," << workloadModelName(config.distribution) << "," << references;
+    return key.str();
+}
+
+const char* CSV_HEADER = "policy,frames,page_size,jobs,distribution,references,faults,fault_rate,seconds,references_per_s,ns_per_reference,peak_rss_kb,translate_ns_per_address";
+// The columns a baseline is read from; files from before columns were appended still qualify
+const char* CSV_BASELINE_COLUMNS = "policy,frames,page_size,jobs,distribution,references,faults,fault_rate,seconds,references_per_s,ns_per_reference";
+
+struct BaselineRow {
+    uint64_t faults;
+    double ns_per_reference;
+};
+
+// Read an earlier CSV of this benchmark into key -> (faults, ns per reference)
+bool loadBaseline(const string& path, unordered_map<string, BaselineRow>& baseline) {
+    ifstream in(path);
+    if (!in) {
+        cerr << "Cannot open baseline " << path << "\n";
+        return false;
+    }
+    string line;
+    if (!getline(in, line) || line.compare(0, strlen(CSV_BASELINE_COLUMNS), CSV_BASELINE_COLUMNS) != 0) {
+        cerr << path << " is not a benchmark CSV\n";
+        return false;
+    }
+    while (getline(in, line)) {
+        vector<string> fields;
+        stringstream row(line);
+        string field;
+        while (getline(row, field, ',')) fields.push_back(field);
+        if (fields.size() < 11) continue;
+        string key = fields[0];
+        for (int i = 1; i < 6; ++i) key += "," + fields[i];
+        baseline[key] = {strtoull(fields[6].c_str(), nullptr, 10), atof(fields[10].c_str())};
+    }
+    return true;
+}
+
+void printBenchmarkUsage(const char* program) {
+    cout << "Usage: " << program << " [options]\n"
+         << "  --algorithms <list>    comma separated policies (default: all)\n"
+         << "  --frames <list>        frame counts (default 64,256,1024)\n"
+         << "  --page-sizes <list>    page sizes in bytes (default 256,4096)\n"
+         << "  --jobs <list>          job counts (default 1,8)\n"
+         << "  --distributions <list> workload models as for --workload (default uniform,hotcold,zipf,sequential)\n"
+         << "  --references <n>       references per configuration (default 100000)\n"
+         << "  --job-size <bytes>     address space of every job (default 1048576)\n"
+         << "  --repeat <n>           runs per configuration, the fastest is reported (default 3)\n"
+         << "  --tlb-entries <n>      TLB size, 0 disables it (default 64)\n"
+         << "  --page-table-levels <n> 1 for flat PMTs (default), 2-4 for radix page tables\n"
+         << "  --output <path>        write the CSV here instead of stdout\n"
+         << "  --baseline <path>      compare against an earlier CSV\n"
+         << "  --tolerance <percent>  slowdown allowed before a configuration fails (default 10)\n";
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    for (int a = 0; a <= (int)ReplacementAlgorithm::OPT; ++a) options.algorithms.push_back((ReplacementAlgorithm)a);
+    int tlbEntries = 64;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        bool ok = true;
+        if (arg == "--algorithms" && hasValue) {
+            ok = parseList<ReplacementAlgorithm>(argv[++i], options.algorithms, parseAlgorithm);
+        } else if (arg == "--frames" && hasValue) {
+            ok = parseList<int>(argv[++i], options.frames, parsePositive);
+        } else if (arg == "--page-sizes" && hasValue) {
+            ok = parseList<int>(argv[++i], options.page_sizes, parsePositive);
+        } else if (arg == "--jobs" && hasValue) {
+            ok = parseList<int>(argv[++i], options.jobs, parsePositive);
+        } else if (arg == "--distributions" && hasValue) {
+            ok = parseList<WorkloadModel>(argv[++i], options.distributions, parseWorkloadModel);
+        } else if (arg == "--references" && hasValue) {
+            options.references = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--job-size" && hasValue) {
+            options.job_size = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--repeat" && hasValue) {
+            options.repeat = max(1, atoi(argv[++i]));
+        } else if (arg == "--tlb-entries" && hasValue) {
+            tlbEntries = atoi(argv[++i]);
+        } else if (arg == "--page-table-levels" && hasValue) {
+            SIM->page_table_levels = atoi(argv[++i]);
+        } else if (arg == "--output" && hasValue) {
+            options.output = argv[++i];
+        } else if (arg == "--baseline" && hasValue) {
+            options.baseline = argv[++i];
+        } else if (arg == "--tolerance" && hasValue) {
+            options.tolerance = atof(argv[++i]);
+        } else if (arg == "--help" || arg == "-h") {
+            printBenchmarkUsage(argv[0]);
+            return 0;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            cerr << "Bad option " << arg << "\n";
+            printBenchmarkUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.references == 0 || options.job_size == 0) {
+        cerr << "--references and --job-size must be positive\n";
+        return 1;
+    }
+    if (SIM->page_table_levels < 1 || SIM->page_table_levels > 4) {
+        cerr << "--page-table-levels must be 1, 2, 3 or 4\n";
+        return 1;
+    }
+    if (!SIM->tlb.configure(tlbEntries, 4, TlbReplacement::LRU) && !SIM->tlb.configure(tlbEntries, 0, TlbReplacement::LRU)) {
+        cerr << "Bad --tlb-entries\n";
+        return 1;
+    }
+
+    unordered_map<string, BaselineRow> baseline;
+    if (!options.baseline.empty() && !loadBaseline(options.baseline, baseline)) return 1;
+
+    ofstream file;
+    if (!options.output.empty()) {
+        file.open(options.output, ios::trunc);
+        if (!file) {
+            cerr << "Cannot write " << options.output << "\n";
+            return 1;
+        }
+    }
+    ostream& csv = options.output.empty() ? cout : file;
+    csv << CSV_HEADER;
+    if (!baseline.empty()) csv << ",baseline_ns_per_reference,change_percent,status";
+    csv << "\n";
+
+    int regressions = 0, changed = 0, compared = 0;
+    for (int jobs : options.jobs) {
+        for (WorkloadModel distribution : options.distributions) {
+            vector<BenchReference> references = generateReferences(options, jobs, distribution);
+            for (int page_size : options.page_sizes) {
+                vector<uint64_t> next;
+                if (find(options.algorithms.begin(), options.algorithms.end(), ReplacementAlgorithm::OPT) != options.algorithms.end())
+                    next = nextUses(references, page_size);
+                for (int frames : options.frames) {
+                    for (ReplacementAlgorithm algorithm : options.algorithms) {
+                        BenchConfig config = {algorithm, frames, page_size, jobs, distribution};
+                        BenchResult best = runConfiguration(config, options, references, next);
+                        double ns = best.seconds * 1e9 / best.references;
+                        string key = configKey(config, best.references);
+                        csv << key << "," << best.faults << "," << fixed << setprecision(6) << (double)best.faults / best.references
+                            << "," << best.seconds << "," << setprecision(0) << best.references / best.seconds << ","
+                            << setprecision(2) << ns << "," << (best.peak_rss_kb >= 0 ? to_string(best.peak_rss_kb) : string()) << "," << best.translate_seconds * 1e9 / best.references;
+                        if (!baseline.empty()) {
+                            auto it = baseline.find(key);
+                            if (it == baseline.end()) {
+                                csv << ",,,new";
+                            } else {
+                                compared++;
+                                double change = 100.0 * (ns - it->second.ns_per_reference) / it->second.ns_per_reference;
+                                const char* status = "ok";
+                                if (it->second.faults != best.faults) {
+                                    status = "faults-changed";
+                                    changed++;
+                                } else if (change > options.tolerance) {
+                                    status = "slower";
+                                    regressions++;
+                                }
+                                csv << "," << it->second.ns_per_reference << "," << change << "," << status;
+                            }
+                        }
+                        csv << "\n";
+                        csv.unsetf(ios::fixed);
+                        csv << setprecision(6) << flush;
+                        if (!options.output.empty()) {
+                            cout << key << ": " << best.faults << " faults, " << setprecision(1) << fixed << ns << " ns/reference\n";
+                            cout.unsetf(ios::fixed);
+                            cout << setprecision(6);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (!baseline.empty()) {
+        cerr << "Compared " << compared << " configurations with " << options.baseline << ": " << regressions
+             << " slower than " << options.tolerance << "%, " << changed << " with different faults\n";
+        if (regressions > 0 || changed > 0) return 1;
+    }
+    return 0;
+}